@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "hsjson.hh"
+
+using namespace hs::json;
+
+/*
+ * Parse throughput driver, also the training run of a profile-guided build
+ * Takes JSON files as arguments, or falls back to a generated corpus
+ */
+
+std::string generated_document()
+{
+  std::string text{"["};
+  for (int i = 0; i < 2000; ++i)
+  {
+    if (i)
+      text += ", ";
+    text += R"({"_id": ")" + std::to_string(i) + R"(", "index": )" + std::to_string(i) +
+            R"(, "isActive": )" + (i % 2 ? "true" : "false") +
+            R"(, "balance": 3392.65, "name": "Susie \"S\" Pineda", "about": "Lorem ipsum dolor sit amet, ét consectetur",)" +
+            R"( "tags": ["velit", "enim", "qui"], "friends": [{"id": 0, "name": "Carolyn"}, {"id": 1, "name": null}]})";
+  }
+  text += "]";
+  return text;
+}
+
+std::vector<std::string> load_corpus(int argc, char **argv)
+{
+  std::vector<std::string> corpus;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::ifstream file{argv[i], std::ios::binary};
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    corpus.push_back(buffer.str());
+  }
+  if (corpus.empty())
+    corpus.push_back(generated_document());
+  return corpus;
+}
+
+// Touches every value so accessors are part of the profile
+double walk(json_value const &value)
+{
+  switch (value.type())
+  {
+  case json_type::number:
+    return value.as<json_number>().get_value();
+  case json_type::boolean:
+    return value.as<json_boolean>().get_value();
+  case json_type::string:
+    return static_cast<double>(value.get_as<std::string_view>().size());
+  case json_type::object:
+  {
+    double sum = 0;
+    for (auto const &[key, member] : value.as<json_object>())
+      sum += key.size() + walk(member);
+    return sum;
+  }
+  case json_type::array:
+  {
+    double sum = 0;
+    for (auto const &element : value.as<json_array>())
+      sum += walk(element);
+    return sum;
+  }
+  default:
+    return 0;
+  }
+}
+
+// Compressed files go through the decompress-and-parse pipeline instead
+bool is_compressed(std::string_view path)
+{
+  return path.ends_with(".gz") or path.ends_with(".zst");
+}
+
+void bench_pipeline(char const *path)
+{
+  std::ifstream file{path, std::ios::binary};
+  pipeline_stats stats{};
+  pipeline_options options{};
+  options.stats = &stats;
+  double checksum = 0;
+  parse_compressed([&file](std::span<char> buffer)
+                   {
+                     file.read(buffer.data(), buffer.size());
+                     return static_cast<std::size_t>(file.gcount());
+                   },
+                   [&checksum](json_value &&value) { checksum += walk(value); }, options);
+
+  std::cout << path << ": " << stats.element_count << " elements, decompress "
+            << stats.decompress_throughput() / 1e6 << " MB/s, parse " << stats.parse_throughput() / 1e6
+            << " MB/s, pipeline " << stats.throughput() / 1e6 << " MB/s (checksum " << checksum << ")\n";
+}
+
+/*
+ * Latency of dropping a large tree at the end of a request: destroyed on the
+ * request thread, handed to a background json_reclaimer, or queued on one
+ * that is collected between every 10 requests
+ */
+void bench_release(std::string const &document)
+{
+  constexpr int requests = 200;
+  for (auto mode : {"in place", "background", "batched"})
+  {
+    std::string_view name{mode};
+    json_reclaimer reclaimer{name == "background"};
+    std::vector<double> latencies;
+    for (int i = 0; i < requests; ++i)
+    {
+      auto tree = parse(document);
+      auto start = std::chrono::steady_clock::now();
+      if (name == "in place")
+        tree = json_value{};
+      else
+        reclaimer.dispose(std::move(tree));
+      latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+      if (name == "batched" and i % 10 == 9)
+        reclaimer.collect();
+    }
+    reclaimer.drain();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "release, " << name << ": p50 " << latencies[requests / 2] << " us, p99 "
+              << latencies[requests * 99 / 100] << " us\n";
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<char *> plain{argv[0]};
+  for (int i = 1; i < argc; ++i)
+    if (is_compressed(argv[i]))
+      bench_pipeline(argv[i]);
+    else
+      plain.push_back(argv[i]);
+  if (plain.size() == 1 and plain.size() < static_cast<std::size_t>(argc))
+    return 0;
+  argc = static_cast<int>(plain.size());
+  argv = plain.data();
+
+  auto corpus = load_corpus(argc, argv);
+  std::size_t bytes = 0;
+  for (auto const &document : corpus)
+    bytes += document.size();
+
+  constexpr int iterations = 50;
+  parser reusable{};
+  double checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    for (auto const &document : corpus)
+      checksum += walk(reusable.parse(document));
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "parse+walk: " << bytes * iterations / elapsed.count() / 1e6 << " MB/s"
+            << " (checksum " << checksum << ")\n";
+
+  std::size_t valid = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    for (auto const &document : corpus)
+      valid += validate(document).valid;
+  elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "validate: " << bytes * iterations / elapsed.count() / 1e6 << " MB/s"
+            << " (" << valid << " valid)\n";
+
+  // Output buffers sized once, as a storage pipeline would
+  std::string pretty, compact;
+  std::size_t written = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    for (auto const &document : corpus)
+    {
+      pretty.resize(std::max(pretty.size(), prettified_size(document)));
+      written += prettify(document, pretty);
+    }
+  elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "prettify: " << bytes * iterations / elapsed.count() / 1e6 << " MB/s in, "
+            << written / elapsed.count() / 1e6 << " MB/s out\n";
+
+  pretty = prettify(corpus.front());
+  compact.resize(pretty.size());
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    written = minify(pretty, compact);
+  elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "minify: " << pretty.size() * iterations / elapsed.count() / 1e6 << " MB/s in ("
+            << pretty.size() << " to " << written << " bytes)\n";
+
+  // A proxy editing one field per document and re-emitting it
+  for (bool keep : {false, true})
+  {
+    parse_options options{};
+    options.keep_source = keep;
+    auto tree = parse(corpus.front(), options);
+    std::size_t out = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+      auto &first = tree.type() == json_type::array ? tree.as<json_array>()[0] : tree;
+      if (first.type() == json_type::object)
+        first.as<json_object>()["edited"] = json_value{json_number{static_cast<double>(i)}};
+      out += serialize(tree).size();
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "edit+serialize" << (keep ? ", kept source: " : ": ") << out / elapsed.count() / 1e6
+              << " MB/s\n";
+  }
+
+  // Export of one large array, the corpus repeated to a few million values
+  json_array rows{};
+  auto records = parse(corpus.front());
+  for (int i = 0; i < 20; ++i)
+    for (auto const &element : records.as<json_array>())
+      rows.push_back(element);
+  json_value exported{std::move(rows)};
+  for (std::size_t threads : {1, 0})
+  {
+    start = std::chrono::steady_clock::now();
+    auto size = serialize(exported, threads).size();
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "serialize, " << (threads ? std::to_string(threads) + " thread" : "every core") << ": "
+              << size / elapsed.count() / 1e6 << " MB/s\n";
+  }
+
+  bench_release(corpus.front());
+}
@@ -1,49 +1,277 @@
 #include "hsjson.hh"
-#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <optional>
+#include <typeinfo>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cerrno>
+#include <string_view>
+#include <utility>
+#include <unordered_set>
+#include <numeric>
+
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef HSJSON_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HSJSON_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 namespace hs::json
 {
-    hs::json::json_number::json_number(double value)
+    /*
+     * Immutable subtree interned by a json_pool, <value> never holds a
+     * shared handle itself
+     */
+    struct json_shared_node
+    {
+        json_value value;
+        std::size_t hash;
+        std::atomic<std::size_t> references{1};
+    };
+
+    namespace detail
+    {
+        HSJSON_INLINE json_shared_node *retain(json_shared_node *node) noexcept
+        {
+            node->references.fetch_add(1, std::memory_order_relaxed);
+            return node;
+        }
+
+        HSJSON_INLINE void release(json_shared_node *node) noexcept
+        {
+            if (node and node->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete node;
+        }
+
+        /*
+         * What a json_value holds in place of a shared subtree, pointer sized
+         * so it stays inside std::any
+         */
+        class shared_subtree
+        {
+        public:
+            explicit shared_subtree(json_shared_node *node) noexcept
+                : m_node{retain(node)}
+            {
+            }
+
+            shared_subtree(shared_subtree const &other) noexcept
+                : m_node{retain(other.m_node)}
+            {
+            }
+
+            shared_subtree(shared_subtree &&other) noexcept
+                : m_node{std::exchange(other.m_node, nullptr)}
+            {
+            }
+
+            shared_subtree &operator=(shared_subtree other) noexcept
+            {
+                std::swap(m_node, other.m_node);
+                return *this;
+            }
+
+            ~shared_subtree()
+            {
+                release(m_node);
+            }
+
+            json_shared_node *node() const noexcept
+            {
+                return m_node;
+            }
+
+        private:
+            json_shared_node *m_node;
+        };
+
+        /*
+         * std::any keeps small nothrow-movable types inline, anything else
+         * lives in a heap block of its own
+         */
+        template <typename T>
+        constexpr bool boxed_in_any = sizeof(T) > sizeof(void *) or
+                                      not std::is_nothrow_move_constructible_v<T>;
+
+        // Red-black tree node: color, parent, left and right links
+        constexpr std::size_t map_node_size =
+            4 * sizeof(void *) + sizeof(std::pair<json_string const, json_value>);
+
+        HSJSON_INLINE std::size_t string_heap_bytes(json_string const &string) noexcept
+        {
+            if (string.capacity() <= json_string{}.capacity())
+                return 0;
+            return string.capacity() + 1;
+        }
+
+        template <typename T>
+        void add_box(json_memory_usage &usage) noexcept
+        {
+            if constexpr (boxed_in_any<T>)
+            {
+                usage.value_bytes += sizeof(T);
+                ++usage.allocations;
+            }
+        }
+
+        HSJSON_INLINE void add_string(std::size_t &bytes, std::size_t &allocations, json_string const &string) noexcept
+        {
+            if (auto n = string_heap_bytes(string))
+            {
+                bytes += n;
+                ++allocations;
+            }
+        }
+
+        // Finalizer of splitmix64, the same on every run and platform
+        constexpr std::uint64_t mix_hash(std::uint64_t h) noexcept
+        {
+            h ^= h >> 30;
+            h *= 0xbf58476d1ce4e5b9;
+            h ^= h >> 27;
+            h *= 0x94d049bb133111eb;
+            return h ^ (h >> 31);
+        }
+
+        HSJSON_INLINE std::uint64_t hash_bytes(std::string_view bytes) noexcept
+        {
+            std::uint64_t h = mix_hash(4 + bytes.size());
+            // An empty view may have no data to copy from
+            if (bytes.empty())
+                return mix_hash(h);
+            auto p = bytes.data();
+            auto end = p + bytes.size();
+            for (; end - p >= 8; p += 8)
+            {
+                std::uint64_t word;
+                std::memcpy(&word, p, 8);
+                h = mix_hash(h ^ word);
+            }
+            std::uint64_t tail = 0;
+            std::memcpy(&tail, p, end - p);
+            return mix_hash(h ^ tail);
+        }
+
+        /*
+         * Hands elements [first, last) of <array> to <visit> in order, those
+         * of a packed array boxed one at a time, so internal walks never
+         * leave the boxed copy of const iteration behind
+         */
+        template <typename Visit>
+        void for_each_element(json_array const &array, std::size_t first, std::size_t last, Visit &&visit)
+        {
+            if (not array.packed())
+                std::for_each(array.begin() + first, array.begin() + last, visit);
+            else
+                for (; first < last; ++first)
+                    visit(array.get_at(first));
+        }
+
+        template <typename Visit>
+        void for_each_element(json_array const &array, Visit &&visit)
+        {
+            for_each_element(array, 0, array.size(), visit);
+        }
+    }
+
+    HSJSON_INLINE std::size_t
+    json_memory_usage::total() const noexcept
+    {
+        return value_bytes + object_bytes + array_bytes + string_bytes + key_bytes;
+    }
+
+    HSJSON_INLINE json_memory_usage &
+    json_memory_usage::operator+=(json_memory_usage const &other) noexcept
+    {
+        value_bytes += other.value_bytes;
+        object_bytes += other.object_bytes;
+        array_bytes += other.array_bytes;
+        string_bytes += other.string_bytes;
+        key_bytes += other.key_bytes;
+        allocations += other.allocations;
+        return *this;
+    }
+
+    HSJSON_INLINE json_string_ref::json_string_ref(char const *data) noexcept
+        : m_data{data}, m_size{std::strlen(data)}
+    {
+    }
+
+    HSJSON_INLINE json_string_ref::json_string_ref(char const *data, std::size_t size) noexcept
+        : m_data{data}, m_size{size}
+    {
+    }
+
+    HSJSON_INLINE std::string_view
+    json_string_ref::view() const noexcept
+    {
+        return {m_data, m_size};
+    }
+
+    HSJSON_INLINE char const *
+    json_string_ref::c_str() const noexcept
+    {
+        return m_data;
+    }
+
+    HSJSON_INLINE hs::json::json_number::json_number(double value)
         : m_value{value}
     {
     }
 
-    double
+    HSJSON_INLINE double
     hs::json::json_number::get_value() const noexcept
     {
         return m_value;
     }
 
-    double &
+    HSJSON_INLINE double &
     hs::json::json_number::value() noexcept
     {
         return m_value;
     }
 
-    void
+    HSJSON_INLINE void
     hs::json::json_number::set_value(double value) noexcept
     {
         m_value = value;
     }
 
-    hs::json::json_boolean::json_boolean(bool b)
+    HSJSON_INLINE hs::json::json_boolean::json_boolean(bool b)
         : m_value{b}
     {
     }
 
-    bool
+    HSJSON_INLINE bool
     hs::json::json_boolean::get_value() const noexcept
     {
         return m_value;
     }
 
-    bool &
+    HSJSON_INLINE bool &
     hs::json::json_boolean::value() noexcept
     {
         return m_value;
     }
 
-    void
+    HSJSON_INLINE void
     hs::json::json_boolean::set_value(bool value) noexcept
     {
         m_value = value;
@@ -51,12 +279,13 @@ namespace hs::json
 
 #define DEFINE_CONSTRUCTOR(from) \
     template <>                        \
-    json_value::json_value<from>(from v) : m_value(std::move(v)) {}
+    HSJSON_INLINE json_value::json_value<from>(from v) : m_value(std::move(v)) {}
 
     DEFINE_CONSTRUCTOR(json_null);
     DEFINE_CONSTRUCTOR(json_number);
     DEFINE_CONSTRUCTOR(json_boolean);
     DEFINE_CONSTRUCTOR(json_string);
+    DEFINE_CONSTRUCTOR(json_string_ref);
     DEFINE_CONSTRUCTOR(json_object);
     DEFINE_CONSTRUCTOR(json_array);
 
@@ -65,7 +294,7 @@ namespace hs::json
 
 #define DEFINE_ASSIGN_OPERATOR(from) \
     template <>                            \
-    json_value &json_value::operator=<from>(from v)    \
+    HSJSON_INLINE json_value &json_value::operator=<from>(from v) \
     {                                      \
         m_value = std::move(v);                       \
         return *this;                      \
@@ -75,6 +304,7 @@ namespace hs::json
     DEFINE_ASSIGN_OPERATOR(json_boolean);
     DEFINE_ASSIGN_OPERATOR(json_number);
     DEFINE_ASSIGN_OPERATOR(json_string);
+    DEFINE_ASSIGN_OPERATOR(json_string_ref);
     DEFINE_ASSIGN_OPERATOR(json_object);
     DEFINE_ASSIGN_OPERATOR(json_array);
 
@@ -82,11 +312,11 @@ namespace hs::json
 
 #define GET_AS(type)                             \
     template <>                                  \
-    type json_value::get_as<type>() const        \
+    HSJSON_INLINE type json_value::get_as<type>() const \
     {                                            \
         try                                      \
         {                                        \
-            return std::any_cast<type>(m_value); \
+            return std::any_cast<type>(held());  \
         }                                        \
         catch (const std::bad_any_cast &)        \
         {                                        \
@@ -97,43 +327,249 @@ namespace hs::json
     GET_AS(json_null);
     GET_AS(json_boolean);
     GET_AS(json_number);
-    GET_AS(json_string);
+    GET_AS(json_string_ref);
     GET_AS(json_object);
     GET_AS(json_array);
 
 #undef GET_AS
 
+    template <>
+    HSJSON_INLINE json_string json_value::get_as<json_string>() const
+    {
+        if (auto ref = std::any_cast<json_string_ref>(&held()))
+            return json_string{ref->view()};
+        if (auto string = std::any_cast<json_string>(&held()))
+            return *string;
+        throw conversion_error;
+    }
+
+    template <>
+    HSJSON_INLINE std::string_view json_value::get_as<std::string_view>() const
+    {
+        if (auto ref = std::any_cast<json_string_ref>(&held()))
+            return ref->view();
+        if (auto string = std::any_cast<json_string>(&held()))
+            return *string;
+        throw conversion_error;
+    }
+
 #define AS(type)                                   \
     template <>                                    \
-    type &json_value::as<type>() &                 \
+    HSJSON_INLINE type &json_value::as<type>() &   \
     {                                              \
-        try                                        \
-        {                                          \
-            return std::any_cast<type &>(m_value); \
-        }                                          \
-        catch (const std::bad_any_cast &)          \
-        {                                          \
+        if (not std::any_cast<type>(&held()))      \
             throw conversion_error;                \
-        }                                          \
+        unshare();                                 \
+        return *std::any_cast<type>(&m_value);     \
     }
 
     AS(json_null);
     AS(json_boolean);
     AS(json_number);
-    AS(json_string);
+    AS(json_string_ref);
     AS(json_object);
     AS(json_array);
 
 #undef AS
 
-    bool
+    template <>
+    HSJSON_INLINE json_string &json_value::as<json_string>() &
+    {
+        // A mutable string has to own its characters
+        unshare();
+        if (auto ref = std::any_cast<json_string_ref>(&m_value))
+            m_value = json_string{ref->view()};
+        if (auto string = std::any_cast<json_string>(&m_value))
+            return *string;
+        throw conversion_error;
+    }
+
+#define CONST_AS(type)                                   \
+    template <>                                          \
+    HSJSON_INLINE type const &json_value::as<type>() const & \
+    {                                                    \
+        try                                              \
+        {                                                \
+            return std::any_cast<type const &>(held());  \
+        }                                                \
+        catch (const std::bad_any_cast &)                \
+        {                                                \
+            throw conversion_error;                      \
+        }                                                \
+    }
+
+    CONST_AS(json_null);
+    CONST_AS(json_boolean);
+    CONST_AS(json_number);
+    CONST_AS(json_string);
+    CONST_AS(json_string_ref);
+    CONST_AS(json_object);
+    CONST_AS(json_array);
+
+#undef CONST_AS
+
+    HSJSON_INLINE json_type
+    json_value::type() const noexcept
+    {
+        auto const &kind = held().type();
+        if (kind == typeid(json_object))
+            return json_type::object;
+        if (kind == typeid(json_array))
+            return json_type::array;
+        if (kind == typeid(json_string) or kind == typeid(json_string_ref))
+            return json_type::string;
+        if (kind == typeid(json_number))
+            return json_type::number;
+        if (kind == typeid(json_boolean))
+            return json_type::boolean;
+        return json_type::null;
+    }
+
+    HSJSON_INLINE json_memory_usage
+    json_value::memory_usage() const noexcept
+    {
+        json_memory_usage usage{};
+        if (auto string = std::any_cast<json_string>(&m_value))
+        {
+            detail::add_box<json_string>(usage);
+            detail::add_string(usage.string_bytes, usage.allocations, *string);
+        }
+        else if (auto object = std::any_cast<json_object>(&m_value))
+        {
+            detail::add_box<json_object>(usage);
+            usage += object->memory_usage();
+        }
+        else if (auto array = std::any_cast<json_array>(&m_value))
+        {
+            detail::add_box<json_array>(usage);
+            usage += array->memory_usage();
+        }
+        else if (std::any_cast<json_string_ref>(&m_value))
+            detail::add_box<json_string_ref>(usage);
+        else if (std::any_cast<detail::shared_subtree>(&m_value))
+            detail::add_box<detail::shared_subtree>(usage);
+        else if (std::any_cast<json_number>(&m_value))
+            detail::add_box<json_number>(usage);
+        else if (std::any_cast<json_boolean>(&m_value))
+            detail::add_box<json_boolean>(usage);
+        return usage;
+    }
+
+    HSJSON_INLINE void
+    json_value::shrink_to_fit()
+    {
+        if (auto string = std::any_cast<json_string>(&m_value))
+            string->shrink_to_fit();
+        else if (auto object = std::any_cast<json_object>(&m_value))
+            object->shrink_to_fit();
+        else if (auto array = std::any_cast<json_array>(&m_value))
+            array->shrink_to_fit();
+    }
+
+    HSJSON_INLINE std::any const &
+    json_value::held() const noexcept
+    {
+        if (auto shared = std::any_cast<detail::shared_subtree>(&m_value))
+            return shared->node()->value.m_value;
+        return m_value;
+    }
+
+    HSJSON_INLINE void
+    json_value::unshare()
+    {
+        if (auto shared = std::any_cast<detail::shared_subtree>(&m_value))
+        {
+            // Children stay shared until they are modified themselves
+            std::any copy = shared->node()->value.m_value;
+            m_value = std::move(copy);
+        }
+    }
+
+    HSJSON_INLINE bool
+    json_value::operator==(json_value const &other) const
+    {
+        auto lhs = std::any_cast<detail::shared_subtree>(&m_value);
+        auto rhs = std::any_cast<detail::shared_subtree>(&other.m_value);
+        if (lhs and rhs)
+        {
+            if (lhs->node() == rhs->node())
+                return true;
+            if (lhs->node()->hash != rhs->node()->hash)
+                return false;
+        }
+
+        auto kind = type();
+        if (kind != other.type())
+            return false;
+        switch (kind)
+        {
+        case json_type::null:
+            return true;
+        case json_type::boolean:
+            return as<json_boolean>().get_value() == other.as<json_boolean>().get_value();
+        case json_type::number:
+            return as<json_number>().get_value() == other.as<json_number>().get_value();
+        case json_type::string:
+            return get_as<std::string_view>() == other.get_as<std::string_view>();
+        case json_type::object:
+            return as<json_object>() == other.as<json_object>();
+        case json_type::array:
+            return as<json_array>() == other.as<json_array>();
+        }
+        return false;
+    }
+
+    HSJSON_INLINE std::size_t
+    json_value::hash() const noexcept
+    {
+        if (auto shared = std::any_cast<detail::shared_subtree>(&m_value))
+            return shared->node()->hash;
+
+        switch (type())
+        {
+        case json_type::null:
+            return detail::mix_hash(1);
+        case json_type::boolean:
+            return detail::mix_hash(2 + as<json_boolean>().get_value());
+        case json_type::number:
+        {
+            // 0.0 and -0.0 compare equal
+            auto number = as<json_number>().get_value();
+            if (number == 0)
+                number = 0;
+            return detail::mix_hash(3 ^ std::bit_cast<std::uint64_t>(number));
+        }
+        case json_type::string:
+            return detail::hash_bytes(get_as<std::string_view>());
+        case json_type::object:
+        {
+            // Summing keeps member order out of the result
+            auto const &object = as<json_object>();
+            std::uint64_t sum = 0;
+            for (auto const &[key, member] : object)
+                sum += detail::mix_hash(detail::hash_bytes(key) ^ (member.hash() * 0x9e3779b97f4a7c15));
+            return detail::mix_hash(sum ^ detail::mix_hash(5 + object.size()));
+        }
+        case json_type::array:
+        {
+            auto const &array = as<json_array>();
+            std::uint64_t h = detail::mix_hash(6 + array.size());
+            detail::for_each_element(array, [&h](json_value const &element)
+                                     { h = detail::mix_hash(h ^ element.hash()); });
+            return h;
+        }
+        }
+        return 0;
+    }
+
+    HSJSON_INLINE bool
     json_object::has_attribute(json_string const &name) const noexcept
     {
         auto it = m_attributes.find(name);
         return it != m_attributes.end();
     }
 
-    json_value
+    HSJSON_INLINE json_value
     json_object::get_attribute(json_string const &name) const
     {
         auto it = m_attributes.find(name);
@@ -142,22 +578,24 @@ namespace hs::json
         return it->second;
     }
 
-    json_value &
+    HSJSON_INLINE json_value &
     json_object::attribute(json_string const &name) &
     {
         auto it = m_attributes.find(name);
         if (it == m_attributes.end())
             throw invalid_access;
+        m_modified = true;
         return it->second;
     }
 
 #define SET_ATTRIBUTE(type)                                               \
     template <>                                                           \
-    void                                                                  \
+    HSJSON_INLINE void                                                    \
     json_object::set_attribute<type>(json_string const &name, type value) \
     {                                                                     \
         if (not has_attribute(name))                                      \
             throw invalid_access;                                         \
+        m_modified = true;                                                \
         m_attributes[name] = std::move(value);                            \
     }
 
@@ -165,33 +603,37 @@ namespace hs::json
     SET_ATTRIBUTE(json_boolean);
     SET_ATTRIBUTE(json_number);
     SET_ATTRIBUTE(json_string);
+    SET_ATTRIBUTE(json_string_ref);
     SET_ATTRIBUTE(json_object);
     SET_ATTRIBUTE(json_array);
 
-    void
+    HSJSON_INLINE void
     json_object::set_attribute(json_string const &name, json_value const &value)
     {
         if (not has_attribute(name))
             throw invalid_access;
+        m_modified = true;
         m_attributes[name] = value;
     }
 
-    void
+    HSJSON_INLINE void
     json_object::set_attribute(json_string const &name, json_value &&value)
     {
         if (not has_attribute(name))
             throw invalid_access;
-        m_attributes[name] = value;
+        m_modified = true;
+        m_attributes[name] = std::move(value);
     }
 
 #undef SET_ATTRIBUTE
 
 #define INSERT_ATTRIBUTE(type)                                                    \
     template <>                                                                   \
-    void json_object::insert_attribute<type>(json_string const &name, type value) \
+    HSJSON_INLINE void json_object::insert_attribute<type>(json_string const &name, type value) \
     {                                                                             \
         if (has_attribute(name))                                                  \
             throw invalid_access;                                                 \
+        m_modified = true;                                                        \
         m_attributes[name] = std::move(value);                                    \
     }
 
@@ -199,84 +641,290 @@ namespace hs::json
     INSERT_ATTRIBUTE(json_boolean);
     INSERT_ATTRIBUTE(json_number);
     INSERT_ATTRIBUTE(json_string);
+    INSERT_ATTRIBUTE(json_string_ref);
     INSERT_ATTRIBUTE(json_object);
     INSERT_ATTRIBUTE(json_array);
 
+    HSJSON_INLINE void
+    json_object::insert_attribute(json_string const &name, json_value const &value)
+    {
+        if (has_attribute(name))
+            throw invalid_access;
+        m_modified = true;
+        m_attributes[name] = value;
+    }
+
+    HSJSON_INLINE void
+    json_object::insert_attribute(json_string const &name, json_value &&value)
+    {
+        if (has_attribute(name))
+            throw invalid_access;
+        m_modified = true;
+        m_attributes[name] = std::move(value);
+    }
+
 #undef INSERT_ATTRIBUTE
 
-    json_value &
+    HSJSON_INLINE json_value &
     json_object::operator[](json_string const &name) &
     {
+        m_modified = true;
         return m_attributes[name];
     }
 
-    int json_object::size() const noexcept
+    HSJSON_INLINE json_value &
+    json_object::operator[](json_string &&name) &
+    {
+        m_modified = true;
+        return m_attributes[std::move(name)];
+    }
+
+    HSJSON_INLINE int json_object::size() const noexcept
     {
         return m_attributes.size();
     }
 
-    size_t
+    HSJSON_INLINE json_object::iterator
+    json_object::begin() noexcept
+    {
+        m_modified = true;
+        return m_attributes.begin();
+    }
+
+    HSJSON_INLINE json_object::iterator
+    json_object::end() noexcept
+    {
+        m_modified = true;
+        return m_attributes.end();
+    }
+
+    HSJSON_INLINE json_object::const_iterator
+    json_object::begin() const noexcept
+    {
+        return m_attributes.begin();
+    }
+
+    HSJSON_INLINE json_object::const_iterator
+    json_object::end() const noexcept
+    {
+        return m_attributes.end();
+    }
+
+    HSJSON_INLINE json_object::const_iterator
+    json_object::cbegin() const noexcept
+    {
+        return m_attributes.cbegin();
+    }
+
+    HSJSON_INLINE json_object::const_iterator
+    json_object::cend() const noexcept
+    {
+        return m_attributes.cend();
+    }
+
+    HSJSON_INLINE json_memory_usage
+    json_object::memory_usage() const noexcept
+    {
+        json_memory_usage usage{};
+        for (auto const &[key, value] : m_attributes)
+        {
+            usage.object_bytes += detail::map_node_size;
+            ++usage.allocations;
+            detail::add_string(usage.key_bytes, usage.allocations, key);
+            usage += value.memory_usage();
+        }
+        return usage;
+    }
+
+    HSJSON_INLINE void
+    json_object::shrink_to_fit()
+    {
+        // Map nodes are exact already and keys are immutable, only values
+        // can give memory back
+        for (auto &[key, value] : m_attributes)
+            value.shrink_to_fit();
+    }
+
+    HSJSON_INLINE bool
+    json_object::operator==(json_object const &other) const
+    {
+        return m_attributes == other.m_attributes;
+    }
+
+    HSJSON_INLINE std::string_view
+    json_object::source() const noexcept
+    {
+        return {m_source.get(), m_source_size};
+    }
+
+    HSJSON_INLINE bool
+    json_object::modified() const noexcept
+    {
+        return m_modified;
+    }
+
+    struct json_array::extras
+    {
+        extras() = default;
+
+        // The boxed copy is made again on demand
+        extras(extras const &other)
+            : numbers(other.numbers), booleans(other.booleans), source{other.source},
+              source_size{other.source_size}, modified{other.modified}
+        {
+        }
+
+        ~extras()
+        {
+            delete boxed.load(std::memory_order_acquire);
+        }
+
+        std::vector<double> numbers{};
+        std::vector<json_boolean> booleans{};
+        std::atomic<container_type *> boxed{nullptr};
+
+        std::shared_ptr<char const> source{};
+        std::size_t source_size = 0;
+        bool modified = false;
+    };
+
+    HSJSON_INLINE json_array::json_array() noexcept = default;
+
+    HSJSON_INLINE json_array::json_array(json_array const &other)
+        : m_values(other.m_values), m_extras{other.m_extras ? std::make_unique<extras>(*other.m_extras) : nullptr}
+    {
+    }
+
+    HSJSON_INLINE json_array::json_array(json_array &&other) noexcept
+        : m_values(std::move(other.m_values)), m_extras{std::move(other.m_extras)}
+    {
+    }
+
+    HSJSON_INLINE json_array &
+    json_array::operator=(json_array const &other)
+    {
+        if (this != &other)
+            *this = json_array{other};
+        return *this;
+    }
+
+    HSJSON_INLINE json_array &
+    json_array::operator=(json_array &&other) noexcept
+    {
+        if (this == &other)
+            return *this;
+        m_values = std::move(other.m_values);
+        m_extras = std::move(other.m_extras);
+        return *this;
+    }
+
+    HSJSON_INLINE json_array::~json_array() = default;
+
+    HSJSON_INLINE json_array::json_array(std::vector<double> numbers)
+    {
+        extra().numbers = std::move(numbers);
+    }
+
+    HSJSON_INLINE json_array::json_array(std::vector<json_boolean> booleans)
+    {
+        extra().booleans = std::move(booleans);
+    }
+
+    HSJSON_INLINE size_t
     json_array::size() const noexcept
     {
+        if (m_extras)
+            return m_values.size() + m_extras->numbers.size() + m_extras->booleans.size();
         return m_values.size();
     }
 
-    bool
+    HSJSON_INLINE bool
     json_array::empty() const noexcept
     {
-        return m_values.empty();
+        return size() == 0;
     }
 
 #define PUSH_BACK(type)                      \
     template <>                              \
-    void json_array::push_back<type>(type v) \
+    HSJSON_INLINE void json_array::push_back<type>(type v) \
     {                                        \
+        unpack();                            \
+        mark_modified();                   \
         m_values.push_back(std::move(v));               \
     }
 
     PUSH_BACK(json_null);
-    PUSH_BACK(json_boolean);
-    PUSH_BACK(json_number);
     PUSH_BACK(json_string);
+    PUSH_BACK(json_string_ref);
     PUSH_BACK(json_object);
     PUSH_BACK(json_array);
 
-    void
+    template <>
+    HSJSON_INLINE void json_array::push_back<json_number>(json_number v)
+    {
+        mark_modified();
+        drop_boxed();
+        if (m_extras and not m_extras->numbers.empty())
+            return m_extras->numbers.push_back(v.get_value());
+        unpack();
+        m_values.push_back(v);
+    }
+
+    template <>
+    HSJSON_INLINE void json_array::push_back<json_boolean>(json_boolean v)
+    {
+        mark_modified();
+        drop_boxed();
+        if (m_extras and not m_extras->booleans.empty())
+            return m_extras->booleans.push_back(v);
+        unpack();
+        m_values.push_back(v);
+    }
+
+    HSJSON_INLINE void
     json_array::push_back(json_value const &v)
     {
+        unpack();
+        mark_modified();
         m_values.push_back(v);
     }
 
-    void
+    HSJSON_INLINE void
     json_array::push_back(json_value &&v)
     {
-        m_values.push_back(v);
+        unpack();
+        mark_modified();
+        m_values.push_back(std::move(v));
     }
 
 #undef PUSH_BACK
 
-    json_value
+    HSJSON_INLINE json_value
     json_array::get_at(size_t index) const
     {
         if (index >= size())
             throw invalid_access;
-        return m_values[index];
+        return packed() ? boxed(index) : m_values[index];
     }
 
-    json_value &
+    HSJSON_INLINE json_value &
     json_array::at(size_t index)
     {
         if (index >= size())
             throw invalid_access;
+        unpack();
+        mark_modified();
         return m_values[index];
     }
 
 #define SET(type)                                    \
     template <>                                      \
-    void json_array::set<type>(size_t index, type t) \
+    HSJSON_INLINE void json_array::set<type>(size_t index, type t) \
     {                                                \
         if (index >= size())                         \
             throw invalid_access;                    \
+        unpack();                                    \
+        mark_modified();                           \
         m_values[index] = std::move(t);                         \
     }
 
@@ -284,359 +932,5020 @@ namespace hs::json
     SET(json_boolean);
     SET(json_number);
     SET(json_string);
+    SET(json_string_ref);
     SET(json_object);
     SET(json_array);
 
-    void
+    HSJSON_INLINE void
     json_array::set(size_t index, json_value const &v)
     {
         if (index >= size())
             throw invalid_access;
+        unpack();
+        mark_modified();
         m_values[index] = v;
     }
-    void
+    HSJSON_INLINE void
     json_array::set(size_t index, json_value &&v)
     {
         if (index >= size())
             throw invalid_access;
-        m_values[index] = v;
+        unpack();
+        mark_modified();
+        m_values[index] = std::move(v);
     }
 
 #undef SET
 
-    json_value &
+    HSJSON_INLINE json_value &
     json_array::operator[](size_t index)
     {
+        unpack();
+        mark_modified();
         return m_values[index];
     }
 
-    namespace
+    HSJSON_INLINE void
+    json_array::reserve(size_t capacity)
     {
+        if (m_extras and not m_extras->numbers.empty())
+            m_extras->numbers.reserve(capacity);
+        else if (m_extras and not m_extras->booleans.empty())
+            m_extras->booleans.reserve(capacity);
+        else
+            m_values.reserve(capacity);
+    }
 
-        using json_stream = std::stringstream;
+    HSJSON_INLINE json_array::iterator
+    json_array::begin()
+    {
+        unpack();
+        mark_modified();
+        return m_values.begin();
+    }
 
-        json_array parse_array(json_stream &s);
-        json_string parse_string(json_stream &s);
-        json_number parse_number(json_stream &s);
-        json_object parse_object(json_stream &s);
-        json_value parse_value(json_stream &s);
-        json_boolean parse_boolean(json_stream &s);
-        json_null parse_null(json_stream &s);
+    HSJSON_INLINE json_array::iterator
+    json_array::end()
+    {
+        unpack();
+        mark_modified();
+        return m_values.end();
+    }
 
-#define SKIP_WHITESPACE()          \
-    while (std::isspace(s.peek())) \
-        s.get();
+    HSJSON_INLINE json_array::const_iterator
+    json_array::begin() const
+    {
+        return values().begin();
+    }
 
-#define CONSUME() c = s.get();
+    HSJSON_INLINE json_array::const_iterator
+    json_array::end() const
+    {
+        return values().end();
+    }
 
-        json_object parse_object(json_stream &s)
-        {
-            using traits = std::char_traits<char>;
-            SKIP_WHITESPACE();
+    HSJSON_INLINE json_array::const_iterator
+    json_array::cbegin() const
+    {
+        return begin();
+    }
 
-            char c = s.peek();
-            if (c != '{')
-            {
-                throw parse_error;
-            }
-            CONSUME();
+    HSJSON_INLINE json_array::const_iterator
+    json_array::cend() const
+    {
+        return end();
+    }
 
-            json_object object{};
-            bool last_attribute = true;
-            for (char c = s.peek(); c != traits::eof(); c = s.peek())
-            {
-                if (std::isspace(c))
-                {
-                    CONSUME();
-                }
-                else if (c == '"')
-                {
-                    auto key{parse_string(s)};
+    HSJSON_INLINE bool
+    json_array::pack()
+    {
+        if (packed() or m_values.empty())
+            return packed();
+        auto kind = m_values.front().type();
+        if (kind != json_type::number and kind != json_type::boolean)
+            return false;
+        for (auto const &value : m_values)
+            if (value.type() != kind)
+                return false;
 
-                    SKIP_WHITESPACE();
+        if (kind == json_type::number)
+        {
+            auto &numbers = extra().numbers;
+            numbers.reserve(m_values.size());
+            for (auto const &value : m_values)
+                numbers.push_back(value.get_as<json_number>().get_value());
+        }
+        else
+        {
+            auto &booleans = extra().booleans;
+            booleans.reserve(m_values.size());
+            for (auto const &value : m_values)
+                booleans.push_back(value.get_as<json_boolean>());
+        }
+        m_values = {};
+        return true;
+    }
 
-                    c = s.peek();
-                    if (c != ':')
-                        throw parse_error;
-                    CONSUME();
+    HSJSON_INLINE bool
+    json_array::packed() const noexcept
+    {
+        return m_extras and (not m_extras->numbers.empty() or not m_extras->booleans.empty());
+    }
+
+    template <>
+    HSJSON_INLINE std::span<double const> json_array::as_span<double>() const
+    {
+        if (not m_values.empty() or (m_extras and not m_extras->booleans.empty()))
+            throw conversion_error;
+        if (not m_extras)
+            return {};
+        return m_extras->numbers;
+    }
+
+    template <>
+    HSJSON_INLINE std::span<json_boolean const> json_array::as_span<json_boolean>() const
+    {
+        if (not m_values.empty() or (m_extras and not m_extras->numbers.empty()))
+            throw conversion_error;
+        if (not m_extras)
+            return {};
+        return m_extras->booleans;
+    }
+
+    HSJSON_INLINE void
+    json_array::unpack()
+    {
+        if (not packed())
+            return;
+        auto &extra = *m_extras;
+        // The boxed copy already holds the elements
+        if (auto copy = extra.boxed.exchange(nullptr))
+        {
+            m_values = std::move(*copy);
+            delete copy;
+        }
+        else
+        {
+            container_type values{};
+            values.reserve(size());
+            for (auto number : extra.numbers)
+                values.emplace_back(json_number{number});
+            for (auto boolean : extra.booleans)
+                values.emplace_back(boolean);
+            m_values = std::move(values);
+        }
+        extra.numbers = {};
+        extra.booleans = {};
+        if (not extra.source)
+            m_extras.reset();
+    }
+
+    HSJSON_INLINE std::string_view
+    json_array::source() const noexcept
+    {
+        if (not m_extras)
+            return {};
+        return {m_extras->source.get(), m_extras->source_size};
+    }
+
+    HSJSON_INLINE bool
+    json_array::modified() const noexcept
+    {
+        return m_extras and m_extras->modified;
+    }
+
+    HSJSON_INLINE json_value
+    json_array::boxed(size_t index) const
+    {
+        if (not m_extras->numbers.empty())
+            return json_number{m_extras->numbers[index]};
+        return m_extras->booleans[index];
+    }
+
+    HSJSON_INLINE json_array::container_type const &
+    json_array::values() const
+    {
+        if (not packed())
+            return m_values;
+        auto &slot = m_extras->boxed;
+        if (auto copy = slot.load(std::memory_order_acquire))
+            return *copy;
+
+        // Concurrent readers may both box, the first to publish wins
+        auto values = std::make_unique<container_type>();
+        values->reserve(size());
+        for (size_t i = 0; i < size(); ++i)
+            values->push_back(boxed(i));
+        container_type *expected = nullptr;
+        if (slot.compare_exchange_strong(expected, values.get(), std::memory_order_acq_rel))
+            return *values.release();
+        return *expected;
+    }
+
+    HSJSON_INLINE void
+    json_array::drop_boxed() noexcept
+    {
+        if (m_extras)
+            delete m_extras->boxed.exchange(nullptr);
+    }
+
+    HSJSON_INLINE json_array::extras &
+    json_array::extra()
+    {
+        if (not m_extras)
+            m_extras = std::make_unique<extras>();
+        return *m_extras;
+    }
+
+    HSJSON_INLINE void
+    json_array::mark_modified() noexcept
+    {
+        if (m_extras)
+            m_extras->modified = true;
+    }
+
+    HSJSON_INLINE json_memory_usage
+    json_array::memory_usage() const noexcept
+    {
+        json_memory_usage usage{};
+        auto bytes = m_values.capacity() * sizeof(json_value);
+        if (bytes)
+        {
+            usage.array_bytes += bytes;
+            ++usage.allocations;
+        }
+        if (m_extras)
+        {
+            usage.array_bytes += sizeof(extras);
+            ++usage.allocations;
+            auto packed_bytes =
+                m_extras->numbers.capacity() * sizeof(double) + m_extras->booleans.capacity() * sizeof(json_boolean);
+            if (packed_bytes)
+            {
+                usage.array_bytes += packed_bytes;
+                ++usage.allocations;
+            }
+            if (auto copy = m_extras->boxed.load(std::memory_order_acquire))
+            {
+                usage.array_bytes += copy->capacity() * sizeof(json_value);
+                ++usage.allocations;
+            }
+        }
+        for (auto const &value : m_values)
+            usage += value.memory_usage();
+        return usage;
+    }
+
+    HSJSON_INLINE void
+    json_array::shrink_to_fit()
+    {
+        m_values.shrink_to_fit();
+        if (m_extras)
+        {
+            m_extras->numbers.shrink_to_fit();
+            m_extras->booleans.shrink_to_fit();
+        }
+        for (auto &value : m_values)
+            value.shrink_to_fit();
+    }
+
+    HSJSON_INLINE bool
+    json_array::operator==(json_array const &other) const
+    {
+        if (size() != other.size())
+            return false;
+        if (packed() and other.packed())
+        {
+            auto const &mine = *m_extras;
+            auto const &theirs = *other.m_extras;
+            if (not mine.numbers.empty() and not theirs.numbers.empty())
+                return mine.numbers == theirs.numbers;
+            if (not mine.booleans.empty() and not theirs.booleans.empty())
+                return std::equal(mine.booleans.begin(), mine.booleans.end(), theirs.booleans.begin(),
+                                  [](json_boolean a, json_boolean b) { return a.get_value() == b.get_value(); });
+        }
+        if (not packed() and not other.packed())
+            return m_values == other.m_values;
+        // Packed as different types
+        if (packed() and other.packed())
+            return false;
+        auto const &packed_side = packed() ? *this : other;
+        auto const &values = packed() ? other.m_values : m_values;
+        for (size_t i = 0; i < values.size(); ++i)
+            if (packed_side.boxed(i) != values[i])
+                return false;
+        return true;
+    }
+
+    namespace detail
+    {
+
+        /*
+         * Returns the first byte in [p, end) that ends a plain run inside a
+         * string: quote, backslash, control or non-ASCII byte
+         */
+        HSJSON_INLINE char const *scan_string_run(char const *p, char const *end) noexcept
+        {
+#if defined(__AVX2__)
+            auto const quote32 = _mm256_set1_epi8('"');
+            auto const backslash32 = _mm256_set1_epi8('\\');
+            auto const control32 = _mm256_set1_epi8(0x1F);
+            for (; end - p >= 32; p += 32)
+            {
+                auto block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+                auto special = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(block, quote32), _mm256_cmpeq_epi8(block, backslash32)),
+                    _mm256_cmpeq_epi8(_mm256_max_epu8(block, control32), control32));
+                // The sign bit of the block itself flags non-ASCII bytes
+                auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(special) | _mm256_movemask_epi8(block));
+                if (mask)
+                    return p + std::countr_zero(mask);
+            }
+#endif
+#if defined(__SSE2__)
+            auto const quote = _mm_set1_epi8('"');
+            auto const backslash = _mm_set1_epi8('\\');
+            auto const control = _mm_set1_epi8(0x1F);
+            for (; end - p >= 16; p += 16)
+            {
+                auto block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+                auto special = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+                    _mm_cmpeq_epi8(_mm_max_epu8(block, control), control));
+                auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(special) | _mm_movemask_epi8(block));
+                if (mask)
+                    return p + std::countr_zero(mask);
+            }
+#endif
+            for (; p != end; ++p)
+            {
+                auto c = static_cast<unsigned char>(*p);
+                if (c == '"' or c == '\\' or c < 0x20 or c >= 0x80)
+                    return p;
+            }
+            return p;
+        }
+
+        /*
+         * Returns the first byte in [p, end) equal to one of <chars>
+         */
+        template <char... chars>
+        char const *find_first_of(char const *p, char const *end) noexcept
+        {
+#if defined(__AVX2__)
+            for (; end - p >= 32; p += 32)
+            {
+                auto block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+                auto found = (... | _mm256_cmpeq_epi8(block, _mm256_set1_epi8(chars)));
+                if (auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(found)))
+                    return p + std::countr_zero(mask);
+            }
+#endif
+#if defined(__SSE2__)
+            for (; end - p >= 16; p += 16)
+            {
+                auto block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+                auto found = (... | _mm_cmpeq_epi8(block, _mm_set1_epi8(chars)));
+                if (auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(found)))
+                    return p + std::countr_zero(mask);
+            }
+#endif
+            for (; p != end; ++p)
+                if (((*p == chars) or ...))
+                    return p;
+            return p;
+        }
+
+        /*
+         * Length of the UTF-8 sequence starting at <p>, 0 when it is invalid
+         * Overlong forms, surrogates and code points above U+10FFFF are rejected
+         */
+        HSJSON_INLINE std::ptrdiff_t utf8_sequence_length(char const *p, char const *end) noexcept
+        {
+            auto byte = [&](std::ptrdiff_t i)
+            { return static_cast<unsigned char>(p[i]); };
+            auto continuation = [&](std::ptrdiff_t i, unsigned char lo = 0x80, unsigned char hi = 0xBF)
+            { return end - p > i and byte(i) >= lo and byte(i) <= hi; };
+
+            auto lead = byte(0);
+            if (lead >= 0xC2 and lead <= 0xDF and continuation(1))
+                return 2;
+            if (lead == 0xE0 and continuation(1, 0xA0) and continuation(2))
+                return 3;
+            if (((lead >= 0xE1 and lead <= 0xEC) or lead == 0xEE or lead == 0xEF) and
+                continuation(1) and continuation(2))
+                return 3;
+            if (lead == 0xED and continuation(1, 0x80, 0x9F) and continuation(2))
+                return 3;
+            if (lead == 0xF0 and continuation(1, 0x90) and continuation(2) and continuation(3))
+                return 4;
+            if (lead >= 0xF1 and lead <= 0xF3 and continuation(1) and continuation(2) and continuation(3))
+                return 4;
+            if (lead == 0xF4 and continuation(1, 0x80, 0x8F) and continuation(2) and continuation(3))
+                return 4;
+            return 0;
+        }
+
+        /*
+         * Validates the UTF-8 sequence starting at <p> and returns its end
+         */
+        HSJSON_INLINE char const *scan_utf8_sequence(char const *p, char const *end)
+        {
+            if (auto length = utf8_sequence_length(p, end))
+                return p + length;
+            throw parse_error;
+        }
+
+        /*
+         * Output of in-place decoding, trails the read position since no
+         * escape decodes to more bytes than it spells
+         */
+        struct in_place_writer
+        {
+            char *out;
+
+            void operator+=(char c) noexcept
+            {
+                *out++ = c;
+            }
+
+            void append(char const *first, char const *last) noexcept
+            {
+                std::memmove(out, first, last - first);
+                out += last - first;
+            }
+        };
+
+        template <typename Out>
+        void append_utf8(Out &out, std::uint32_t cp)
+        {
+            if (cp < 0x80)
+                out += static_cast<char>(cp);
+            else if (cp < 0x800)
+            {
+                out += static_cast<char>(0xC0 | (cp >> 6));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000)
+            {
+                out += static_cast<char>(0xE0 | (cp >> 12));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                out += static_cast<char>(0xF0 | (cp >> 18));
+                out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+        }
+
+        constexpr std::uint32_t invalid_hex4 = 0x10000;
+
+        // Value of the four hex digits at <p>, <invalid_hex4> when malformed
+        HSJSON_INLINE std::uint32_t hex4(char const *p, char const *end) noexcept
+        {
+            if (end - p < 4)
+                return invalid_hex4;
+            std::uint32_t value = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                char c = p[i];
+                value <<= 4;
+                if (c >= '0' and c <= '9')
+                    value |= c - '0';
+                else if (c >= 'a' and c <= 'f')
+                    value |= c - 'a' + 10;
+                else if (c >= 'A' and c <= 'F')
+                    value |= c - 'A' + 10;
+                else
+                    return invalid_hex4;
+            }
+            return value;
+        }
+
+        HSJSON_INLINE std::uint32_t parse_hex4(char const *p, char const *end)
+        {
+            auto value = hex4(p, end);
+            if (value == invalid_hex4)
+                throw parse_error;
+            return value;
+        }
+
+        /*
+         * Length of the escape sequence starting at the backslash <p>, 0 when
+         * it is malformed. Checks what decode_escape() does without decoding
+         */
+        HSJSON_INLINE std::ptrdiff_t escape_length(char const *p, char const *end) noexcept
+        {
+            if (end - p < 2)
+                return 0;
+            switch (p[1])
+            {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                return 2;
+            case 'u':
+                break;
+            default:
+                return 0;
+            }
+
+            auto cp = hex4(p + 2, end);
+            if (cp == invalid_hex4 or (cp >= 0xDC00 and cp <= 0xDFFF))
+                return 0;
+            if (cp < 0xD800 or cp > 0xDBFF)
+                return 6;
+            if (end - p < 8 or p[6] != '\\' or p[7] != 'u')
+                return 0;
+            auto low = hex4(p + 8, end);
+            return low >= 0xDC00 and low <= 0xDFFF ? 12 : 0;
+        }
+
+        /*
+         * Decodes the escape sequence starting at the backslash <p> into <out>
+         * and returns the position after it
+         */
+        template <typename Out>
+        char const *decode_escape(char const *p, char const *end, Out &out)
+        {
+            if (end - p < 2)
+                throw parse_error;
+            switch (p[1])
+            {
+            case '"': out += '"'; return p + 2;
+            case '\\': out += '\\'; return p + 2;
+            case '/': out += '/'; return p + 2;
+            case 'b': out += '\b'; return p + 2;
+            case 'f': out += '\f'; return p + 2;
+            case 'n': out += '\n'; return p + 2;
+            case 'r': out += '\r'; return p + 2;
+            case 't': out += '\t'; return p + 2;
+            case 'u': break;
+            default: throw parse_error;
+            }
+
+            auto cp = parse_hex4(p + 2, end);
+            p += 6;
+            if (cp >= 0xDC00 and cp <= 0xDFFF)
+                throw parse_error;
+            if (cp >= 0xD800 and cp <= 0xDBFF)
+            {
+                // A high surrogate is only valid as the first half of a pair
+                if (end - p < 2 or p[0] != '\\' or p[1] != 'u')
+                    throw parse_error;
+                auto low = parse_hex4(p + 2, end);
+                if (low < 0xDC00 or low > 0xDFFF)
+                    throw parse_error;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                p += 6;
+            }
+            append_utf8(out, cp);
+            return p;
+        }
+
+        using stats_clock = std::chrono::steady_clock;
+
+#ifdef HSJSON_NO_STATS
+        constexpr parse_stats *collecting(parse_stats *) noexcept
+        {
+            return nullptr;
+        }
+#else
+        constexpr parse_stats *collecting(parse_stats *stats) noexcept
+        {
+            return stats;
+        }
+#endif
+
+        HSJSON_INLINE std::atomic<parse_observer *> g_observer{nullptr};
+
+        /*
+         * Adds the lifetime of the scope to one phase counter, does nothing
+         * when stats are not collected
+         */
+        class phase_timer
+        {
+        public:
+            phase_timer(parse_stats *stats, std::chrono::nanoseconds parse_stats::*phase) noexcept
+                : m_stats{stats}, m_phase{phase}
+            {
+                if (m_stats)
+                    m_start = stats_clock::now();
+            }
+
+            ~phase_timer()
+            {
+                if (m_stats)
+                    m_stats->*m_phase += stats_clock::now() - m_start;
+            }
+
+        private:
+            parse_stats *m_stats;
+            std::chrono::nanoseconds parse_stats::*m_phase;
+            stats_clock::time_point m_start{};
+        };
+
+        HSJSON_INLINE void count_allocation(parse_stats *stats, std::size_t bytes) noexcept
+        {
+            ++stats->allocation_count;
+            stats->allocation_bytes += bytes;
+        }
+
+        template <typename T>
+        void count_boxing(parse_stats *stats) noexcept
+        {
+            if constexpr (boxed_in_any<T>)
+                count_allocation(stats, sizeof(T));
+        }
+
+        HSJSON_INLINE void count_string(parse_stats *stats, json_string const &string) noexcept
+        {
+            if (auto n = string_heap_bytes(string))
+                count_allocation(stats, n);
+        }
+
+        HSJSON_INLINE bool is_whitespace(int c) noexcept
+        {
+            return c == ' ' or c == '\n' or c == '\r' or c == '\t';
+        }
+
+        HSJSON_INLINE bool is_digit(int c) noexcept
+        {
+            return c >= '0' and c <= '9';
+        }
+
+        /*
+         * Decimal exponent of the leading digit of the number token [p, end),
+         * saturated far past the range of double. Tells a number from_chars
+         * found out of range too large (above zero) from too small
+         */
+        HSJSON_INLINE long long decimal_exponent(char const *p, char const *end) noexcept
+        {
+            // Past any double either way, keeps huge exponents from wrapping
+            constexpr long long saturated = 1'000'000;
+
+            if (*p == '-')
+                ++p;
+            long long magnitude = 0;
+            bool leading = false;
+            bool fraction = false;
+            for (; p != end and *p != 'e' and *p != 'E'; ++p)
+            {
+                if (*p == '.')
+                    fraction = true;
+                else if (leading)
+                    magnitude += not fraction;
+                else
+                {
+                    magnitude -= fraction;
+                    leading = *p != '0';
+                }
+            }
+
+            long long exponent = 0;
+            bool negative = false;
+            if (p != end)
+            {
+                ++p;
+                negative = *p == '-';
+                if (*p == '-' or *p == '+')
+                    ++p;
+                for (; p != end; ++p)
+                    exponent = std::min(exponent * 10 + (*p - '0'), saturated);
+            }
+            return magnitude + (negative ? -exponent : exponent);
+        }
+
+        /*
+         * Returns the first non-whitespace byte in [p, end)
+         * Tokens are mostly separated by nothing or a single space, longer
+         * runs are indentation and are skipped a block at a time
+         */
+        HSJSON_INLINE char const *skip_whitespace_run(char const *p, char const *end) noexcept
+        {
+            if (p == end or not is_whitespace(*p))
+                return p;
+            ++p;
+#if defined(__SSE2__)
+            auto const space = _mm_set1_epi8(' ');
+            auto const newline = _mm_set1_epi8('\n');
+            auto const carriage_return = _mm_set1_epi8('\r');
+            auto const tab = _mm_set1_epi8('\t');
+            for (; end - p >= 16; p += 16)
+            {
+                auto block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+                auto blank = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, newline)),
+                    _mm_or_si128(_mm_cmpeq_epi8(block, carriage_return), _mm_cmpeq_epi8(block, tab)));
+                auto mask = ~static_cast<std::uint32_t>(_mm_movemask_epi8(blank)) & 0xFFFF;
+                if (mask)
+                    return p + std::countr_zero(mask);
+            }
+#endif
+            while (p != end and is_whitespace(*p))
+                ++p;
+            return p;
+        }
+
+        /*
+         * Returns the end of the number token starting at <p>, nullptr when it
+         * does not follow the JSON number grammar
+         */
+        HSJSON_INLINE char const *scan_number(char const *p, char const *end) noexcept
+        {
+            auto digits = [&]()
+            {
+                auto start = p;
+                while (p != end and is_digit(*p))
+                    ++p;
+                return p != start;
+            };
+
+            if (p != end and *p == '-')
+                ++p;
+            if (p != end and *p == '0')
+                ++p;
+            else if (not digits())
+                return nullptr;
+            if (p != end and *p == '.')
+            {
+                ++p;
+                if (not digits())
+                    return nullptr;
+            }
+            if (p != end and (*p == 'e' or *p == 'E'))
+            {
+                ++p;
+                if (p != end and (*p == '-' or *p == '+'))
+                    ++p;
+                if (not digits())
+                    return nullptr;
+            }
+            return p;
+        }
+
+        HSJSON_INLINE void count_array(parse_stats *stats, std::size_t bytes) noexcept
+        {
+            count_boxing<json_array>(stats);
+            if (bytes)
+                count_allocation(stats, bytes);
+        }
+    }
+
+    HSJSON_INLINE void set_parse_observer(parse_observer *observer) noexcept
+    {
+        detail::g_observer.store(observer, std::memory_order_release);
+    }
+
+    HSJSON_INLINE json_reader::json_reader(std::string_view s, parse_options const &options)
+        : m_options{options}
+    {
+        reset(s);
+    }
+
+    HSJSON_INLINE void
+    json_reader::reset(std::string_view s)
+    {
+        m_in_situ = false;
+        if (s.size() > m_options.max_document_size)
+            throw limit_error;
+        m_begin = s.data();
+        m_cur = s.data();
+        m_end = s.data() + s.size();
+        m_stats = detail::collecting(m_options.stats);
+        m_state = state::value;
+        m_stack.clear();
+    }
+
+    HSJSON_INLINE parse_options &
+    json_reader::options() noexcept
+    {
+        return m_options;
+    }
+
+    HSJSON_INLINE json_type
+    json_reader::peek_type()
+    {
+        expect_value();
+        switch (peek())
+        {
+        case '{':
+            return json_type::object;
+        case '[':
+            return json_type::array;
+        case '"':
+            return json_type::string;
+        case 't':
+        case 'f':
+            return json_type::boolean;
+        case 'n':
+            return json_type::null;
+        default:
+            if (peek() == '-' or detail::is_digit(peek()))
+                return json_type::number;
+            throw parse_error;
+        }
+    }
+
+    HSJSON_INLINE bool
+    json_reader::next()
+    {
+        if (m_state == state::value)
+            skip_value();
+
+        skip_whitespace();
+        switch (m_state)
+        {
+        case state::first_value:
+            if (peek() == ']')
+            {
+                close(']');
+                return false;
+            }
+            m_state = state::value;
+            return true;
+        case state::first_key:
+            if (peek() == '}')
+            {
+                close('}');
+                return false;
+            }
+            [[fallthrough]];
+        case state::key:
+            read_key();
+            return true;
+        case state::after_value:
+            if (m_stack.empty())
+            {
+                if (peek() != json_string::traits_type::eof())
+                    throw parse_error;
+                m_state = state::done;
+                return false;
+            }
+            if (peek() == ',')
+            {
+                ++m_cur;
+                if (m_stack.back() == '{')
+                    read_key();
+                else
+                    m_state = state::value;
+                return true;
+            }
+            if (peek() == '}' or peek() == ']')
+            {
+                close(peek());
+                return false;
+            }
+            throw parse_error;
+        case state::value:
+        case state::done:
+            break;
+        }
+        return false;
+    }
+
+    HSJSON_INLINE std::string_view
+    json_reader::key() const noexcept
+    {
+        return m_key;
+    }
+
+    HSJSON_INLINE std::string_view
+    json_reader::read_string_view()
+    {
+        if (peek_type() != json_type::string)
+            throw conversion_error;
+        read_value();
+        return m_string;
+    }
+
+    HSJSON_INLINE double
+    json_reader::read_number()
+    {
+        if (peek_type() != json_type::number)
+            throw conversion_error;
+        read_value();
+        return m_number;
+    }
+
+    HSJSON_INLINE bool
+    json_reader::read_boolean()
+    {
+        if (peek_type() != json_type::boolean)
+            throw conversion_error;
+        read_value();
+        return m_boolean;
+    }
+
+    HSJSON_INLINE void
+    json_reader::read_null()
+    {
+        if (peek_type() != json_type::null)
+            throw conversion_error;
+        read_value();
+    }
+
+    HSJSON_INLINE void
+    json_reader::skip_value()
+    {
+        expect_value();
+        auto depth = m_stack.size();
+        read_value();
+        while (m_stack.size() > depth)
+            next_token();
+    }
+
+    HSJSON_INLINE void
+    json_reader::enter_object()
+    {
+        if (peek_type() != json_type::object)
+            throw conversion_error;
+        read_value();
+    }
+
+    HSJSON_INLINE void
+    json_reader::enter_array()
+    {
+        if (peek_type() != json_type::array)
+            throw conversion_error;
+        read_value();
+    }
+
+    HSJSON_INLINE std::size_t
+    json_reader::depth() const noexcept
+    {
+        return m_stack.size();
+    }
+
+    HSJSON_INLINE std::size_t
+    json_reader::offset() const noexcept
+    {
+        return m_cur - m_begin;
+    }
+
+    HSJSON_INLINE json_reader::token
+    json_reader::next_token()
+    {
+        skip_whitespace();
+        m_token = m_cur;
+        switch (m_state)
+        {
+        case state::first_value:
+            if (peek() == ']')
+                return close(']');
+            [[fallthrough]];
+        case state::value:
+            return read_value();
+        case state::first_key:
+            if (peek() == '}')
+                return close('}');
+            [[fallthrough]];
+        case state::key:
+            read_key();
+            return token::key;
+        case state::after_value:
+        {
+            int c = peek();
+            if (m_stack.empty())
+            {
+                if (c != json_string::traits_type::eof())
+                    throw parse_error;
+                m_state = state::done;
+                return token::end;
+            }
+            if (c == ',')
+            {
+                ++m_cur;
+                m_state = m_stack.back() == '{' ? state::key : state::value;
+                return next_token();
+            }
+            if (c == '}' or c == ']')
+                return close(c);
+            throw parse_error;
+        }
+        case state::done:
+            break;
+        }
+        return token::end;
+    }
+
+    HSJSON_INLINE json_reader::token
+    json_reader::read_value()
+    {
+        skip_whitespace();
+        int c = peek();
+        m_state = state::after_value;
+        switch (c)
+        {
+        case '{':
+        case '[':
+            return open(c);
+        case '"':
+            m_string = m_in_situ ? read_string_in_place() : read_string(m_buffer);
+            return token::string;
+        case 't':
+        case 'f':
+            m_boolean = c == 't';
+            read_literal(m_boolean ? "true" : "false");
+            if (m_stats)
+                ++m_stats->boolean_count;
+            return token::boolean;
+        case 'n':
+            read_literal("null");
+            if (m_stats)
+                ++m_stats->null_count;
+            return token::null;
+        default:
+            if (c == '-' or detail::is_digit(c))
+            {
+                read_number_token();
+                return token::number;
+            }
+            throw parse_error;
+        }
+    }
+
+    HSJSON_INLINE json_reader::token
+    json_reader::open(char bracket)
+    {
+        ++m_cur;
+        if (m_stack.size() >= m_options.max_depth)
+            throw limit_error;
+        m_stack.push_back(bracket);
+        if (m_stats)
+        {
+            m_stats->max_depth = std::max(m_stats->max_depth, m_stack.size());
+            ++(bracket == '{' ? m_stats->object_count : m_stats->array_count);
+        }
+        m_state = bracket == '{' ? state::first_key : state::first_value;
+        return bracket == '{' ? token::begin_object : token::begin_array;
+    }
+
+    HSJSON_INLINE json_reader::token
+    json_reader::close(char bracket)
+    {
+        if (m_stack.empty() or m_stack.back() != (bracket == '}' ? '{' : '['))
+            throw parse_error;
+        ++m_cur;
+        m_stack.pop_back();
+        m_state = state::after_value;
+        return bracket == '}' ? token::end_object : token::end_array;
+    }
+
+    HSJSON_INLINE void
+    json_reader::read_key()
+    {
+        skip_whitespace();
+        if (peek() != '"')
+            throw parse_error;
+        m_key = read_string(m_key_buffer);
+        skip_whitespace();
+        if (peek() != ':')
+            throw parse_error;
+        ++m_cur;
+        m_state = state::value;
+    }
+
+    HSJSON_INLINE std::string_view
+    json_reader::read_string(json_string &buffer)
+    {
+        auto start = m_cur + 1;
+        auto p = start;
+        // Strings without escapes are returned as views into the input, the
+        // buffer only comes into play from the first backslash on
+        bool decoding = false;
+        while (true)
+        {
+            auto run = detail::scan_string_run(p, m_end);
+            if (decoding)
+                buffer.append(p, run);
+            p = run;
+            if ((decoding ? buffer.size() : p - start) > m_options.max_string_length)
+                throw limit_error;
+            if (p == m_end)
+                throw parse_error;
+
+            auto c = static_cast<unsigned char>(*p);
+            if (c == '"')
+                break;
+            else if (c == '\\')
+            {
+                if (not decoding)
+                    buffer.assign(start, p);
+                decoding = true;
+                p = detail::decode_escape(p, m_end, buffer);
+            }
+            else if (c < 0x20)
+                throw parse_error;
+            else
+            {
+                auto next = detail::scan_utf8_sequence(p, m_end);
+                if (decoding)
+                    buffer.append(p, next);
+                p = next;
+            }
+        }
+        m_cur = p + 1;
+
+        std::string_view string = decoding ? std::string_view{buffer} : std::string_view{start, p};
+        if (string.size() > m_options.max_string_length)
+            throw limit_error;
+        if (m_stats)
+        {
+            ++m_stats->string_count;
+            m_stats->string_bytes += string.size();
+        }
+        return string;
+    }
+
+    HSJSON_INLINE std::string_view
+    json_reader::read_string_in_place()
+    {
+        // The caller handed over a mutable buffer for in-situ parses
+        auto start = const_cast<char *>(m_cur) + 1;
+        char const *p = start;
+        detail::in_place_writer writer{start};
+        m_escaped = false;
+        while (true)
+        {
+            auto run = detail::scan_string_run(p, m_end);
+            if (m_escaped)
+                writer.append(p, run);
+            p = run;
+            if (static_cast<std::size_t>((m_escaped ? writer.out : p) - start) > m_options.max_string_length)
+                throw limit_error;
+            if (p == m_end)
+                throw parse_error;
+
+            auto c = static_cast<unsigned char>(*p);
+            if (c == '"')
+                break;
+            else if (c == '\\')
+            {
+                if (not m_escaped)
+                    writer.out = start + (p - start);
+                m_escaped = true;
+                p = detail::decode_escape(p, m_end, writer);
+            }
+            else if (c < 0x20)
+                throw parse_error;
+            else
+            {
+                auto next = detail::scan_utf8_sequence(p, m_end);
+                if (m_escaped)
+                    writer.append(p, next);
+                p = next;
+            }
+        }
+        m_cur = p + 1;
+
+        // Terminate in place, at the latest on the closing quote
+        std::size_t length = (m_escaped ? writer.out : p) - start;
+        start[length] = '\0';
+        if (m_stats)
+        {
+            ++m_stats->string_count;
+            m_stats->string_bytes += length;
+        }
+        return {start, length};
+    }
+
+    HSJSON_INLINE void
+    json_reader::read_literal(std::string_view literal)
+    {
+        if (static_cast<std::size_t>(m_end - m_cur) < literal.size() or
+            std::string_view{m_cur, literal.size()} != literal)
+            throw parse_error;
+        m_cur += literal.size();
+    }
+
+    HSJSON_INLINE void
+    json_reader::read_number_token()
+    {
+        auto begin = m_cur;
+        auto p = detail::scan_number(begin, m_end);
+        if (not p)
+            throw parse_error;
+        m_cur = p;
+
+        detail::phase_timer timer{m_stats, &parse_stats::number_time};
+        auto [ptr, ec] = std::from_chars(begin, p, m_number);
+        if (ec == std::errc::result_out_of_range)
+        {
+            // Infinity could not be written back, numbers too small for a
+            // double round to zero
+            if (detail::decimal_exponent(begin, p) > 0)
+                throw limit_error;
+            m_number = *begin == '-' ? -0.0 : 0.0;
+        }
+        else if (ec != std::errc{} or ptr != p)
+            throw parse_error;
+        if (m_stats)
+            ++m_stats->number_count;
+    }
+
+    HSJSON_INLINE void
+    json_reader::skip_whitespace() noexcept
+    {
+        m_cur = detail::skip_whitespace_run(m_cur, m_end);
+    }
+
+    HSJSON_INLINE int
+    json_reader::peek() const noexcept
+    {
+        if (m_cur == m_end)
+            return json_string::traits_type::eof();
+        return json_string::traits_type::to_int_type(*m_cur);
+    }
+
+    HSJSON_INLINE void
+    json_reader::expect_value()
+    {
+        if (m_state != state::value)
+            throw invalid_access;
+        skip_whitespace();
+    }
+
+    HSJSON_INLINE std::size_t
+    json_schema::compile_node(json_value const &schema)
+    {
+        auto index = m_nodes.size();
+        m_nodes.emplace_back();
+        node n{};
+
+        if (schema.type() == json_type::boolean)
+        {
+            if (not schema.as<json_boolean>().get_value())
+                n.types = 0;
+            m_nodes[index] = std::move(n);
+            return index;
+        }
+        if (schema.type() != json_type::object)
+            throw schema_error;
+
+        auto number = [](json_value const &value)
+        {
+            if (value.type() != json_type::number)
+                throw schema_error;
+            return value.as<json_number>().get_value();
+        };
+        auto count = [&](json_value const &value)
+        {
+            auto v = number(value);
+            if (v < 0 or v != static_cast<double>(static_cast<std::size_t>(v)))
+                throw schema_error;
+            return static_cast<std::size_t>(v);
+        };
+        auto type_bit = [](json_value const &value)
+        {
+            static constexpr std::pair<std::string_view, unsigned> names[] = {
+                {"null", 1u << static_cast<unsigned>(json_type::null)},
+                {"boolean", 1u << static_cast<unsigned>(json_type::boolean)},
+                {"number", 1u << static_cast<unsigned>(json_type::number)},
+                {"string", 1u << static_cast<unsigned>(json_type::string)},
+                {"object", 1u << static_cast<unsigned>(json_type::object)},
+                {"array", 1u << static_cast<unsigned>(json_type::array)},
+                {"integer", integer_type},
+            };
+            if (value.type() != json_type::string)
+                throw schema_error;
+            for (auto [name, bit] : names)
+                if (value.get_as<std::string_view>() == name)
+                    return bit;
+            throw schema_error;
+        };
+        auto scalar = [](json_value const &value)
+        {
+            if (value.type() == json_type::object or value.type() == json_type::array)
+                throw schema_error;
+            return value;
+        };
+
+        static constexpr std::string_view unsupported[] = {
+            "$ref", "allOf", "anyOf", "oneOf", "not", "if", "then", "else",
+            "pattern", "patternProperties", "propertyNames", "multipleOf",
+            "uniqueItems", "contains", "prefixItems", "dependencies",
+            "dependentRequired", "dependentSchemas", "unevaluatedItems",
+            "unevaluatedProperties"};
+
+        for (auto const &[keyword, value] : schema.as<json_object>())
+        {
+            if (std::ranges::find(unsupported, keyword) != std::end(unsupported))
+                throw schema_error;
+
+            if (keyword == "type")
+            {
+                if (value.type() == json_type::array)
+                {
+                    n.types = 0;
+                    for (auto const &name : value.as<json_array>())
+                        n.types |= type_bit(name);
+                }
+                else
+                    n.types = type_bit(value);
+            }
+            else if (keyword == "enum")
+            {
+                if (value.type() != json_type::array)
+                    throw schema_error;
+                for (auto const &member : value.as<json_array>())
+                    n.enumeration.push_back(scalar(member));
+            }
+            else if (keyword == "const")
+                n.enumeration.push_back(scalar(value));
+            else if (keyword == "minimum")
+                n.minimum = number(value);
+            else if (keyword == "maximum")
+                n.maximum = number(value);
+            else if (keyword == "exclusiveMinimum" or keyword == "exclusiveMaximum")
+            {
+                // Draft 4 uses a flag on minimum/maximum, later drafts a bound
+                bool lower = keyword == "exclusiveMinimum";
+                if (value.type() == json_type::boolean)
+                {
+                    auto const &object = schema.as<json_object>();
+                    auto bound = lower ? "minimum" : "maximum";
+                    if (value.as<json_boolean>().get_value() and object.has_attribute(bound))
+                        (lower ? n.exclusive_minimum : n.exclusive_maximum) = number(object.get_attribute(bound));
+                }
+                else
+                    (lower ? n.exclusive_minimum : n.exclusive_maximum) = number(value);
+            }
+            else if (keyword == "minLength")
+                n.min_length = count(value);
+            else if (keyword == "maxLength")
+                n.max_length = count(value);
+            else if (keyword == "minItems")
+                n.min_items = count(value);
+            else if (keyword == "maxItems")
+                n.max_items = count(value);
+            else if (keyword == "minProperties")
+                n.min_properties = count(value);
+            else if (keyword == "maxProperties")
+                n.max_properties = count(value);
+            else if (keyword == "properties")
+            {
+                if (value.type() != json_type::object)
+                    throw schema_error;
+                // Map iteration is key ordered, lookups can binary search
+                for (auto const &[name, member] : value.as<json_object>())
+                    n.properties.emplace_back(name, compile_node(member));
+            }
+            else if (keyword == "required")
+            {
+                if (value.type() != json_type::array)
+                    throw schema_error;
+                for (auto const &name : value.as<json_array>())
+                {
+                    if (name.type() != json_type::string)
+                        throw schema_error;
+                    n.required.push_back(json_string{name.get_as<std::string_view>()});
+                }
+            }
+            else if (keyword == "additionalProperties")
+            {
+                if (value.type() == json_type::boolean)
+                    n.additional_properties = value.as<json_boolean>().get_value();
+                else
+                    n.additional = compile_node(value);
+            }
+            else if (keyword == "items")
+                n.items = compile_node(value);
+        }
+
+        m_nodes[index] = std::move(n);
+        return index;
+    }
+
+    HSJSON_INLINE json_schema
+    json_schema::compile(json_value const &schema)
+    {
+        json_schema compiled{};
+        compiled.compile_node(schema);
+        return compiled;
+    }
+
+    /*
+     * Checks a stream of parse events against the compiled nodes
+     * Keeps one frame per open container to track keys, counts and the
+     * required members seen so far
+     */
+    class json_schema::validator
+    {
+    public:
+        validator(json_schema const &schema, schema_violation *report)
+            : m_schema{schema}, m_report{report}
+        {
+        }
+
+        void begin(bool is_object, std::size_t offset)
+        {
+            auto index = enter(is_object ? json_type::object : json_type::array, 0, offset);
+
+            if (m_frames.size() == m_depth)
+                m_frames.emplace_back();
+            auto &f = m_frames[m_depth++];
+            f.node = index;
+            f.is_object = is_object;
+            f.offset = offset;
+            f.count = 0;
+            f.child = npos;
+            f.key.clear();
+            f.names.clear();
+            f.seen.assign(index != npos and is_object ? m_schema.m_nodes[index].required.size() : 0, 0);
+        }
+
+        void key(std::string_view key, std::size_t offset)
+        {
+            auto &f = m_frames[m_depth - 1];
+            f.key.assign(key);
+            f.child = npos;
+            if (f.node == npos)
+                return;
+
+            // A repeated key replaces the member in the tree, so bounds count
+            // each name once
+            auto const &n = m_schema.m_nodes[f.node];
+            if (n.min_properties == 0 and n.max_properties == npos)
+                ++f.count;
+            else if (f.names.insert(f.key).second)
+                ++f.count;
+            auto it = std::ranges::lower_bound(n.properties, key, {}, [](auto const &property)
+                                               { return std::string_view{property.first}; });
+            if (it != n.properties.end() and it->first == key)
+                f.child = it->second;
+            else if (not n.additional_properties)
+                fail("property is not allowed", offset, m_depth);
+            else
+                f.child = n.additional;
+
+            for (std::size_t i = 0; i < n.required.size(); ++i)
+                if (n.required[i] == key)
+                    f.seen[i] = 1;
+        }
+
+        void scalar(json_type type, std::string_view string, double number, bool boolean, std::size_t offset)
+        {
+            auto index = enter(type, number, offset);
+            if (index == npos)
+                return;
+
+            auto const &n = m_schema.m_nodes[index];
+            if (type == json_type::string)
+            {
+                // Lengths count code points, so skip UTF-8 continuation bytes
+                auto length = std::ranges::count_if(string, [](char c)
+                                                    { return (static_cast<unsigned char>(c) & 0xC0) != 0x80; });
+                if (static_cast<std::size_t>(length) < n.min_length)
+                    fail("string is shorter than minLength", offset, m_depth);
+                if (static_cast<std::size_t>(length) > n.max_length)
+                    fail("string is longer than maxLength", offset, m_depth);
+            }
+            else if (type == json_type::number)
+            {
+                if (number < n.minimum)
+                    fail("number is below minimum", offset, m_depth);
+                if (number > n.maximum)
+                    fail("number is above maximum", offset, m_depth);
+                if (number <= n.exclusive_minimum)
+                    fail("number is not above exclusiveMinimum", offset, m_depth);
+                if (number >= n.exclusive_maximum)
+                    fail("number is not below exclusiveMaximum", offset, m_depth);
+            }
+
+            if (not n.enumeration.empty())
+            {
+                auto matches = [&](json_value const &member)
+                {
+                    if (member.type() != type)
+                        return false;
+                    switch (type)
+                    {
+                    case json_type::boolean:
+                        return member.as<json_boolean>().get_value() == boolean;
+                    case json_type::number:
+                        return member.as<json_number>().get_value() == number;
+                    case json_type::string:
+                        return member.get_as<std::string_view>() == string;
+                    default:
+                        return true;
+                    }
+                };
+                if (std::ranges::none_of(n.enumeration, matches))
+                    fail("value is not one of enum", offset, m_depth);
+            }
+        }
+
+        void end()
+        {
+            auto &f = m_frames[m_depth - 1];
+            if (f.node != npos)
+            {
+                auto const &n = m_schema.m_nodes[f.node];
+                if (f.is_object)
+                {
+                    for (std::size_t i = 0; i < n.required.size(); ++i)
+                        if (not f.seen[i])
+                            fail("missing required property \"" + n.required[i] + "\"", f.offset, m_depth - 1);
+                    if (f.count < n.min_properties)
+                        fail("object has fewer than minProperties members", f.offset, m_depth - 1);
+                    if (f.count > n.max_properties)
+                        fail("object has more than maxProperties members", f.offset, m_depth - 1);
+                }
+                else
+                {
+                    if (f.count < n.min_items)
+                        fail("array has fewer than minItems elements", f.offset, m_depth - 1);
+                    if (f.count > n.max_items)
+                        fail("array has more than maxItems elements", f.offset, m_depth - 1);
+                }
+            }
+            --m_depth;
+        }
+
+    private:
+        struct frame
+        {
+            std::size_t node = npos;
+            bool is_object = false;
+            std::size_t offset = 0;
+            std::size_t count = 0;
+            std::size_t child = npos;
+            json_string key{};
+            std::unordered_set<json_string> names{};
+            std::vector<char> seen{};
+        };
+
+        /*
+         * Resolve the node of the value starting here and check its type
+         */
+        std::size_t enter(json_type type, double number, std::size_t offset)
+        {
+            auto index = std::size_t{0};
+            if (m_depth)
+            {
+                auto &f = m_frames[m_depth - 1];
+                if (f.is_object)
+                    index = f.child;
+                else
+                {
+                    ++f.count;
+                    index = f.node == npos ? npos : m_schema.m_nodes[f.node].items;
+                }
+            }
+            if (index == npos)
+                return npos;
+
+            auto types = m_schema.m_nodes[index].types;
+            bool matches = types & (1u << static_cast<unsigned>(type));
+            if (not matches and type == json_type::number and types & integer_type)
+                matches = std::isfinite(number) and std::trunc(number) == number;
+            if (not matches)
+                fail("value does not match type", offset, m_depth);
+            return index;
+        }
+
+        /*
+         * Report a violation on the value enclosed by the first <depth> frames
+         */
+        [[noreturn]] void fail(std::string message, std::size_t offset, std::size_t depth)
+        {
+            if (m_report)
+            {
+                m_report->valid = false;
+                m_report->offset = offset;
+                m_report->message = std::move(message);
+                m_report->path.clear();
+                for (std::size_t i = 0; i < depth; ++i)
+                {
+                    auto const &f = m_frames[i];
+                    m_report->path += '/';
+                    if (not f.is_object)
+                    {
+                        m_report->path += std::to_string(f.count - 1);
+                        continue;
+                    }
+                    // JSON pointer escapes
+                    for (char c : f.key)
+                    {
+                        if (c == '~')
+                            m_report->path += "~0";
+                        else if (c == '/')
+                            m_report->path += "~1";
+                        else
+                            m_report->path += c;
+                    }
+                }
+            }
+            throw schema_error;
+        }
+
+        json_schema const &m_schema;
+        schema_violation *m_report;
+        std::vector<frame> m_frames{};
+        std::size_t m_depth = 0;
+    };
+
+    HSJSON_INLINE void
+    json_schema::feed(validator &v, json_reader const &reader, json_reader::token tok)
+    {
+        using token = json_reader::token;
+        std::size_t offset = reader.m_token - reader.m_begin;
+        switch (tok)
+        {
+        case token::begin_object:
+        case token::begin_array:
+            v.begin(tok == token::begin_object, offset);
+            break;
+        case token::end_object:
+        case token::end_array:
+            v.end();
+            break;
+        case token::key:
+            v.key(reader.m_key, offset);
+            break;
+        case token::string:
+            v.scalar(json_type::string, reader.m_string, 0, false, offset);
+            break;
+        case token::number:
+            v.scalar(json_type::number, {}, reader.m_number, false, offset);
+            break;
+        case token::boolean:
+            v.scalar(json_type::boolean, {}, 0, reader.m_boolean, offset);
+            break;
+        case token::null:
+            v.scalar(json_type::null, {}, 0, false, offset);
+            break;
+        case token::end:
+            break;
+        }
+    }
+
+    HSJSON_INLINE schema_violation
+    json_schema::validate(std::string_view text, parse_options const &options) const
+    {
+        schema_violation result{};
+        validator v{*this, &result};
+        json_reader reader{text, options};
+        try
+        {
+            for (auto tok = reader.next_token(); tok != json_reader::token::end; tok = reader.next_token())
+                feed(v, reader, tok);
+        }
+        catch (int error)
+        {
+            if (error != schema_error)
+                throw;
+        }
+        return result;
+    }
+
+    HSJSON_INLINE json_projection
+    json_projection::compile(std::vector<std::string_view> const &paths)
+    {
+        json_projection projection{};
+        projection.m_nodes.emplace_back();
+
+        for (auto path : paths)
+        {
+            // An empty pointer selects the whole document
+            if (path.empty())
+                return {};
+            if (path.front() != '/')
+                throw parse_error;
+
+            std::size_t index = 0;
+            while (index != keep_all and not path.empty())
+            {
+                path.remove_prefix(1);
+                auto length = std::min(path.find('/'), path.size());
+                json_string key{};
+                for (std::size_t i = 0; i < length; ++i)
+                {
+                    if (path[i] != '~')
+                        key += path[i];
+                    else if (i + 1 < length and (path[i + 1] == '0' or path[i + 1] == '1'))
+                        key += path[++i] == '0' ? '~' : '/';
+                    else
+                        throw parse_error;
+                }
+                path.remove_prefix(length);
+
+                auto &children = projection.m_nodes[index].children;
+                auto it = std::ranges::find(children, key, &std::pair<json_string, std::size_t>::first);
+                if (it == children.end())
+                {
+                    // The last segment keeps the whole subtree
+                    auto child = path.empty() ? keep_all : projection.m_nodes.size();
+                    projection.m_nodes[index].children.emplace_back(std::move(key), child);
+                    if (child != keep_all)
+                        projection.m_nodes.emplace_back();
+                    index = child;
+                }
+                else
+                {
+                    if (path.empty())
+                        it->second = keep_all;
+                    index = it->second;
+                }
+            }
+        }
+
+        for (auto &n : projection.m_nodes)
+            std::ranges::sort(n.children);
+        return projection;
+    }
+
+    HSJSON_INLINE std::size_t
+    json_projection::find(std::size_t node, std::string_view key) const noexcept
+    {
+        if (m_nodes.empty())
+            return keep_all;
+        auto const &children = m_nodes[node].children;
+        auto it = std::ranges::lower_bound(children, key, {}, [](auto const &child)
+                                           { return std::string_view{child.first}; });
+        if (it == children.end() or it->first != key)
+            return skip;
+        return it->second;
+    }
+
+    HSJSON_INLINE
+    json_pool::json_pool(json_pool &&other) noexcept
+        : m_nodes{std::exchange(other.m_nodes, {})}
+    {
+    }
+
+    HSJSON_INLINE json_pool &
+    json_pool::operator=(json_pool &&other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            m_nodes = std::exchange(other.m_nodes, {});
+        }
+        return *this;
+    }
+
+    HSJSON_INLINE
+    json_pool::~json_pool()
+    {
+        clear();
+    }
+
+    HSJSON_INLINE json_value
+    json_pool::intern(json_value value)
+    {
+        auto &contents = value.m_value;
+        if (std::any_cast<detail::shared_subtree>(&contents))
+            return value;
+
+        // Children first, so comparing candidates below stops at node identity
+        if (auto object = std::any_cast<json_object>(&contents))
+        {
+            for (auto &[key, member] : *object)
+                member = intern(std::move(member));
+        }
+        else if (auto array = std::any_cast<json_array>(&contents))
+        {
+            // Packed elements hold nothing worth sharing
+            if (not array->packed())
+                for (auto &element : *array)
+                    element = intern(std::move(element));
+        }
+        else if (auto string = std::any_cast<json_string>(&contents); not string or not detail::string_heap_bytes(*string))
+            return value;
+
+        auto hash = value.hash();
+        auto [first, last] = m_nodes.equal_range(hash);
+        for (; first != last; ++first)
+            if (first->second->value == value)
+            {
+                json_value shared{};
+                shared.m_value = detail::shared_subtree{first->second};
+                return shared;
+            }
+
+        auto node = new json_shared_node{std::move(value), hash};
+        m_nodes.emplace(hash, node);
+        json_value shared{};
+        shared.m_value = detail::shared_subtree{node};
+        return shared;
+    }
+
+    HSJSON_INLINE std::size_t
+    json_pool::size() const noexcept
+    {
+        return m_nodes.size();
+    }
+
+    HSJSON_INLINE json_memory_usage
+    json_pool::memory_usage() const noexcept
+    {
+        json_memory_usage usage{};
+        for (auto const &[hash, node] : m_nodes)
+        {
+            // Nested shared nodes count as handles, each node is seen once
+            usage.value_bytes += sizeof(json_shared_node);
+            ++usage.allocations;
+            usage += node->value.memory_usage();
+        }
+        return usage;
+    }
+
+    HSJSON_INLINE void
+    json_pool::clear() noexcept
+    {
+        for (auto const &[hash, node] : m_nodes)
+            detail::release(node);
+        m_nodes.clear();
+    }
+
+    struct json_reclaimer_state
+    {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::vector<json_value> queue;
+
+        // Trees the worker is destroying right now
+        std::size_t destroying = 0;
+        bool stop = false;
+        std::thread worker;
+
+        void run()
+        {
+            // Batches swap with the queue, so both keep their capacity and
+            // dispose() rarely allocates
+            std::vector<json_value> batch;
+            std::unique_lock lock{mutex};
+            for (;;)
+            {
+                wake.wait(lock, [this] { return stop or not queue.empty(); });
+                if (queue.empty())
+                    return;
+                batch.swap(queue);
+                destroying = batch.size();
+                lock.unlock();
+                batch.clear();
+                lock.lock();
+                destroying = 0;
+                idle.notify_all();
+            }
+        }
+    };
+
+    HSJSON_INLINE json_reclaimer::json_reclaimer(bool background)
+        : m_state{std::make_unique<json_reclaimer_state>()}
+    {
+        if (background)
+            m_state->worker = std::thread{&json_reclaimer_state::run, m_state.get()};
+    }
+
+    HSJSON_INLINE json_reclaimer::~json_reclaimer()
+    {
+        {
+            std::lock_guard lock{m_state->mutex};
+            m_state->stop = true;
+        }
+        m_state->wake.notify_one();
+        // The worker empties the queue before it returns
+        if (m_state->worker.joinable())
+            m_state->worker.join();
+        m_state->queue.clear();
+    }
+
+    HSJSON_INLINE void
+    json_reclaimer::dispose(json_value &&value)
+    {
+        {
+            std::lock_guard lock{m_state->mutex};
+            m_state->queue.push_back(std::move(value));
+        }
+        if (m_state->worker.joinable())
+            m_state->wake.notify_one();
+    }
+
+    HSJSON_INLINE std::size_t
+    json_reclaimer::collect()
+    {
+        std::vector<json_value> batch;
+        {
+            std::lock_guard lock{m_state->mutex};
+            batch.swap(m_state->queue);
+        }
+        return batch.size();
+    }
+
+    HSJSON_INLINE void
+    json_reclaimer::drain()
+    {
+        if (not m_state->worker.joinable())
+        {
+            collect();
+            return;
+        }
+        std::unique_lock lock{m_state->mutex};
+        m_state->idle.wait(lock, [this] { return m_state->queue.empty() and m_state->destroying == 0; });
+    }
+
+    HSJSON_INLINE std::size_t
+    json_reclaimer::pending() const
+    {
+        std::lock_guard lock{m_state->mutex};
+        return m_state->queue.size() + m_state->destroying;
+    }
+
+    HSJSON_INLINE parser::parser(parse_options const &options)
+        : m_options{options}
+    {
+    }
+
+    HSJSON_INLINE parse_options &
+    parser::options() noexcept
+    {
+        return m_options;
+    }
+
+    HSJSON_INLINE void
+    parser::shrink_to_fit()
+    {
+        m_reader = {};
+        m_frames = {};
+        m_values = {};
+    }
+
+    HSJSON_INLINE json_value
+    parser::parse(std::string_view s)
+    {
+        return build(s, false);
+    }
+
+    HSJSON_INLINE json_value
+    parser::parse_in_situ(std::span<char> buffer)
+    {
+        return build({buffer.data(), buffer.size()}, true);
+    }
+
+    HSJSON_INLINE json_value
+    parser::build(std::string_view s, bool in_situ)
+    {
+        parse_stats observed{};
+        auto options = m_options;
+#ifndef HSJSON_NO_STATS
+        if (not options.stats and detail::g_observer.load(std::memory_order_acquire))
+            options.stats = &observed;
+#endif
+        auto stats = detail::collecting(options.stats);
+        if (stats)
+            *stats = {};
+        auto start = stats ? detail::stats_clock::now() : detail::stats_clock::time_point{};
+
+        // Kept spans point into a copy of the input the tree shares, which
+        // the reader then goes over in place of <s>
+        auto keep_source = options.keep_source and not in_situ and not options.pool and not options.projection;
+        std::shared_ptr<json_string const> document{};
+        if (keep_source)
+        {
+            document = std::make_shared<json_string const>(s);
+            s = *document;
+            if (stats)
+                detail::count_allocation(stats, s.size());
+        }
+
+        auto &reader = m_reader;
+        reader.options() = options;
+        reader.reset(s);
+        reader.m_in_situ = in_situ;
+
+        std::optional<json_schema::validator> validator{};
+        if (options.schema)
+        {
+            if (options.violation)
+                *options.violation = {};
+            validator.emplace(*options.schema, options.violation);
+        }
+        m_values.clear();
+        std::size_t depth = 0;
+        json_value root{};
+        // Text of the container <top> closes, none when a key repeats within
+        auto source = [&](frame const &top) -> std::shared_ptr<char const>
+        {
+            if (depth and top.repeated_key)
+                m_frames[depth - 1].repeated_key = true;
+            if (not keep_source or top.repeated_key)
+                return {};
+            return {document, top.source};
+        };
+
+        // Every finished value is moved into its parent exactly once
+        auto attach = [&](json_value &&value)
+        {
+            detail::phase_timer timer{stats, &parse_stats::build_time};
+            if (options.pool)
+                value = options.pool->intern(std::move(value));
+            if (depth == 0)
+                root = std::move(value);
+            else if (auto &top = m_frames[depth - 1]; top.is_object)
+            {
+                if (stats)
+                {
+                    detail::count_allocation(stats, detail::map_node_size);
+                    detail::count_string(stats, top.key);
+                }
+                if (keep_source and top.object.has_attribute(top.key))
+                    top.repeated_key = true;
+                top.object[top.key] = std::move(value);
+            }
+            else
+                m_values.push_back(std::move(value));
+        };
+
+        using token = json_reader::token;
+        for (auto tok = reader.next_token(); tok != token::end; tok = reader.next_token())
+        {
+            // Reject before anything below the violation gets built
+            if (validator)
+                json_schema::feed(*validator, reader, tok);
+
+            // A path going on past a scalar selects nothing of it
+            auto scalar = tok == token::string or tok == token::number or tok == token::boolean or tok == token::null;
+            if (scalar and options.projection and depth)
+            {
+                auto const &top = m_frames[depth - 1];
+                if ((top.is_object ? top.next_projection : top.projection) != json_projection::keep_all)
+                    continue;
+            }
+
+            switch (tok)
+            {
+            case token::begin_object:
+            case token::begin_array:
+            {
+                // Arrays hand their own projection down to every element
+                auto projection = json_projection::keep_all;
+                if (options.projection and depth == 0)
+                    projection = 0;
+                else if (depth)
+                {
+                    auto const &parent = m_frames[depth - 1];
+                    projection = parent.is_object ? parent.next_projection : parent.projection;
+                }
+
+                // Frames outlive the parse so their key buffers are reused
+                if (m_frames.size() == depth)
+                    m_frames.emplace_back();
+                auto &top = m_frames[depth++];
+                top.is_object = tok == token::begin_object;
+                top.object = {};
+                top.first = m_values.size();
+                top.projection = projection;
+                top.source = reader.m_token;
+                top.repeated_key = false;
+                break;
+            }
+            case token::end_object:
+            {
+                auto &top = m_frames[--depth];
+                if (stats)
+                    detail::count_boxing<json_object>(stats);
+                if (auto text = source(top))
+                {
+                    top.object.m_source = std::move(text);
+                    top.object.m_source_size = static_cast<std::size_t>(reader.m_cur - top.source);
+                }
+                top.object.m_modified = false;
+                attach(json_value{std::move(top.object)});
+                break;
+            }
+            case token::end_array:
+            {
+                auto &top = m_frames[--depth];
+                auto first = m_values.begin() + top.first;
+                auto count = static_cast<std::size_t>(m_values.end() - first);
+                json_array array{};
+                std::size_t bytes = 0;
+                {
+                    detail::phase_timer timer{stats, &parse_stats::build_time};
+                    // All-number and all-boolean arrays go straight to packed
+                    // storage, without boxing the elements in between
+                    auto kind = count and options.pack_arrays ? first->type() : json_type::null;
+                    auto uniform = std::all_of(first, m_values.end(), [kind](json_value const &value)
+                                               { return value.type() == kind; });
+                    if (uniform and kind == json_type::number)
+                    {
+                        std::vector<double> numbers;
+                        numbers.reserve(count);
+                        for (auto it = first; it != m_values.end(); ++it)
+                            numbers.push_back(it->as<json_number>().get_value());
+                        array = json_array{std::move(numbers)};
+                        bytes = count * sizeof(double);
+                    }
+                    else if (uniform and kind == json_type::boolean)
+                    {
+                        std::vector<json_boolean> booleans;
+                        booleans.reserve(count);
+                        for (auto it = first; it != m_values.end(); ++it)
+                            booleans.push_back(it->as<json_boolean>());
+                        array = json_array{std::move(booleans)};
+                        bytes = count * sizeof(json_boolean);
+                    }
+                    else
+                    {
+                        array.reserve(count);
+                        for (auto it = first; it != m_values.end(); ++it)
+                            array.push_back(std::move(*it));
+                        bytes = count * sizeof(json_value);
+                    }
+                    m_values.erase(first, m_values.end());
+                }
+                if (stats)
+                    detail::count_array(stats, bytes);
+                if (auto text = source(top))
+                {
+                    auto &extra = array.extra();
+                    extra.source = std::move(text);
+                    extra.source_size = static_cast<std::size_t>(reader.m_cur - top.source);
+                    extra.modified = false;
+                }
+                attach(json_value{std::move(array)});
+                break;
+            }
+            case token::key:
+            {
+                auto &top = m_frames[depth - 1];
+                top.next_projection = json_projection::keep_all;
+                if (top.projection != json_projection::keep_all)
+                {
+                    top.next_projection = options.projection->find(top.projection, reader.m_key);
+                    if (top.next_projection == json_projection::skip)
+                    {
+                        reader.skip_value();
+                        break;
+                    }
+                }
+                top.key.assign(reader.m_key);
+                break;
+            }
+            case token::string:
+            {
+                auto view = reader.m_string;
+                if (in_situ and not (reader.m_escaped and std::memchr(view.data(), 0, view.size())))
+                {
+                    if (stats)
+                        detail::count_boxing<json_string_ref>(stats);
+                    attach(json_value{json_string_ref{view.data(), view.size()}});
+                    break;
+                }
+                json_string string{view};
+                if (stats)
+                {
+                    detail::count_boxing<json_string>(stats);
+                    detail::count_string(stats, string);
+                }
+                attach(json_value{std::move(string)});
+                break;
+            }
+            case token::number:
+                if (stats)
+                    detail::count_boxing<json_number>(stats);
+                attach(json_value{json_number{reader.m_number}});
+                break;
+            case token::boolean:
+                if (stats)
+                    detail::count_boxing<json_boolean>(stats);
+                attach(json_value{json_boolean{reader.m_boolean}});
+                break;
+            case token::null:
+                attach(json_value{json_null{}});
+                break;
+            case token::end:
+                break;
+            }
+        }
+
+        if (stats)
+        {
+            stats->bytes_consumed = reader.offset();
+            stats->tokenize_time = detail::stats_clock::now() - start - stats->number_time - stats->build_time;
+            if (auto observer = detail::g_observer.load(std::memory_order_acquire))
+                observer->on_parse(*stats);
+        }
+        return root;
+    }
+
+    HSJSON_INLINE json_value parse(json_string const &s)
+    {
+        return parser{}.parse(s);
+    }
+
+    HSJSON_INLINE json_value parse(json_string const &s, parse_stats &stats)
+    {
+        parse_options options{};
+        options.stats = &stats;
+        return parser{options}.parse(s);
+    }
+
+    HSJSON_INLINE json_value parse(json_string const &s, parse_options const &options)
+    {
+        return parser{options}.parse(s);
+    }
+
+    HSJSON_INLINE json_value parse_in_situ(std::span<char> buffer)
+    {
+        return parser{}.parse_in_situ(buffer);
+    }
+
+    HSJSON_INLINE json_value parse_in_situ(std::span<char> buffer, parse_options const &options)
+    {
+        return parser{options}.parse_in_situ(buffer);
+    }
+
+    namespace detail
+    {
+        // Nesting validate() tracks without allocating, one bit per open container
+        constexpr std::size_t validate_inline_depth = 4096;
+
+        // Bytes the escape of <length> bytes at the backslash <p> decodes to
+        HSJSON_INLINE std::size_t decoded_escape_length(char const *p, std::ptrdiff_t length) noexcept
+        {
+            if (length == 2)
+                return 1;
+            if (length == 12)
+                return 4;
+            auto cp = hex4(p + 2, p + length);
+            return cp < 0x80 ? 1 : cp < 0x800 ? 2 : 3;
+        }
+
+        /*
+         * Returns the position after the closing quote of the string whose
+         * contents start at <p>, or nullptr with <error> on the offending byte
+         * and <code> set. Decoded strings longer than <max_length> are
+         * refused where they cross it, before any later malformed byte, as
+         * parse() does
+         */
+        HSJSON_INLINE char const *skip_string(char const *p, char const *end, std::size_t max_length,
+                                              char const *&error, int &code) noexcept
+        {
+            std::size_t decoded = 0;
+            code = parse_error;
+            for (;;)
+            {
+                auto run = scan_string_run(p, end);
+                decoded += run - p;
+                if (decoded > max_length)
+                {
+                    code = limit_error;
+                    p = run - (decoded - max_length);
+                    break;
+                }
+                p = run;
+                if (p == end)
+                    break;
+                auto c = static_cast<unsigned char>(*p);
+                if (c == '"')
+                    return p + 1;
+                auto length = c == '\\' ? escape_length(p, end) : c < 0x20 ? 0 : utf8_sequence_length(p, end);
+                if (not length)
+                    break;
+                decoded += c == '\\' ? decoded_escape_length(p, length) : length;
+                if (decoded > max_length)
+                {
+                    code = limit_error;
+                    break;
+                }
+                p += length;
+            }
+            error = p;
+            return nullptr;
+        }
+    }
+
+    HSJSON_INLINE validation_result validate(std::string_view text, parse_options const &options) noexcept
+    {
+        auto const begin = text.data();
+        auto const end = begin + text.size();
+        auto fail = [begin](char const *at, int error = parse_error)
+        { return validation_result{false, error, static_cast<std::size_t>(at - begin)}; };
+
+        if (text.size() > options.max_document_size)
+            return fail(begin, limit_error);
+
+        // Bit set when the container at that depth is an object, the words
+        // past the inline ones are only allocated for documents that deep
+        std::uint64_t objects[detail::validate_inline_depth / 64];
+        std::vector<std::uint64_t> deeper{};
+        auto word = [&](std::size_t at) -> std::uint64_t &
+        {
+            return at < detail::validate_inline_depth ? objects[at / 64]
+                                                      : deeper[(at - detail::validate_inline_depth) / 64];
+        };
+        std::size_t depth = 0;
+        auto in_object = [&]()
+        { return word(depth - 1) >> ((depth - 1) % 64) & 1; };
+
+        enum class expect { value, key, after_value } next = expect::value;
+        auto p = detail::skip_whitespace_run(begin, end);
+        char const *error = nullptr;
+        int code = parse_error;
+        for (;;)
+        {
+            switch (next)
+            {
+            case expect::value:
+                if (p == end)
+                    return fail(p);
+                switch (*p)
+                {
+                case '{':
+                case '[':
+                {
+                    if (depth == options.max_depth)
+                        return fail(p, limit_error);
+                    if (depth >= detail::validate_inline_depth and depth % 64 == 0)
+                    {
+                        try
+                        {
+                            deeper.push_back(0);
+                        }
+                        catch (std::bad_alloc const &)
+                        {
+                            return fail(p, limit_error);
+                        }
+                    }
+                    auto object = *p == '{';
+                    auto &bits = word(depth);
+                    auto bit = std::uint64_t{1} << (depth % 64);
+                    bits = object ? bits | bit : bits & ~bit;
+                    ++depth;
+                    p = detail::skip_whitespace_run(p + 1, end);
+                    if (p != end and *p == (object ? '}' : ']'))
+                    {
+                        --depth;
+                        ++p;
+                        next = expect::after_value;
+                    }
+                    else
+                        next = object ? expect::key : expect::value;
+                    continue;
+                }
+                case '"':
+                    if (not (p = detail::skip_string(p + 1, end, options.max_string_length, error, code)))
+                        return fail(error, code);
+                    break;
+                case 't':
+                case 'f':
+                case 'n':
+                {
+                    std::string_view literal = *p == 't' ? "true" : *p == 'f' ? "false" : "null";
+                    if (static_cast<std::size_t>(end - p) < literal.size() or
+                        std::memcmp(p, literal.data(), literal.size()) != 0)
+                        return fail(p);
+                    p += literal.size();
+                    break;
+                }
+                default:
+                {
+                    auto number = detail::scan_number(p, end);
+                    if (not number)
+                        return fail(p);
+                    // parse() refuses numbers too large for a double, only
+                    // those near the edge need converting to tell
+                    if (detail::decimal_exponent(p, number) >= std::numeric_limits<double>::max_exponent10)
+                    {
+                        double value;
+                        if (std::from_chars(p, number, value).ec == std::errc::result_out_of_range)
+                            return fail(p, limit_error);
+                    }
+                    p = number;
+                }
+                }
+                next = expect::after_value;
+                continue;
+
+            case expect::key:
+                if (p == end or *p != '"')
+                    return fail(p);
+                if (not (p = detail::skip_string(p + 1, end, options.max_string_length, error, code)))
+                    return fail(error, code);
+                p = detail::skip_whitespace_run(p, end);
+                if (p == end or *p != ':')
+                    return fail(p);
+                p = detail::skip_whitespace_run(p + 1, end);
+                next = expect::value;
+                continue;
+
+            case expect::after_value:
+                p = detail::skip_whitespace_run(p, end);
+                if (depth == 0)
+                    return p == end ? validation_result{} : fail(p);
+                if (p == end)
+                    return fail(p);
+                if (*p == ',')
+                {
+                    p = detail::skip_whitespace_run(p + 1, end);
+                    next = in_object() ? expect::key : expect::value;
+                }
+                else if (*p == (in_object() ? '}' : ']'))
+                {
+                    --depth;
+                    ++p;
+                }
+                else
+                    return fail(p);
+                continue;
+            }
+        }
+    }
+
+    namespace detail
+    {
+        // Output of the text transforms into a caller sized buffer
+        struct span_output
+        {
+            char *out;
+            char *limit;
+
+            void reserve(std::size_t n) const
+            {
+                if (static_cast<std::size_t>(limit - out) < n)
+                    throw write_error;
+            }
+
+            void operator+=(char c)
+            {
+                reserve(1);
+                *out++ = c;
+            }
+
+            void append(char const *first, char const *last)
+            {
+                reserve(last - first);
+                // Minifying in place writes behind the read position
+                std::memmove(out, first, last - first);
+                out += last - first;
+            }
+
+            void fill(char c, std::size_t n)
+            {
+                reserve(n);
+                std::memset(out, c, n);
+                out += n;
+            }
+        };
+
+        // Measures what a transform would write
+        struct counting_output
+        {
+            std::size_t size = 0;
+
+            void operator+=(char) noexcept
+            {
+                ++size;
+            }
+
+            void append(char const *first, char const *last) noexcept
+            {
+                size += last - first;
+            }
+
+            void fill(char, std::size_t n) noexcept
+            {
+                size += n;
+            }
+        };
+
+        /*
+         * Returns the position after the closing quote of the string opening
+         * at <p>, contents are not looked at beyond escaped quotes
+         */
+        HSJSON_INLINE char const *skip_raw_string(char const *p, char const *end)
+        {
+            for (++p;; p += 2)
+            {
+                p = find_first_of<'"', '\\'>(p, end);
+                if (p == end or (*p == '\\' and end - p < 2))
+                    throw parse_error;
+                if (*p == '"')
+                    return p + 1;
+            }
+        }
+
+        /*
+         * Returns the end of the value text starting at <p>, containers are
+         * matched bracket by bracket
+         */
+        HSJSON_INLINE char const *skip_value_text(char const *p, char const *end)
+        {
+            if (*p == '"')
+                return skip_raw_string(p, end);
+            if (*p != '{' and *p != '[')
+            {
+                while (p != end and not is_whitespace(*p) and *p != ',' and *p != '}' and *p != ']')
+                    ++p;
+                return p;
+            }
+            for (std::size_t depth = 0;;)
+            {
+                p = find_first_of<'"', '{', '[', '}', ']'>(p, end);
+                if (p == end)
+                    throw parse_error;
+                if (*p == '"')
+                    p = skip_raw_string(p, end);
+                else if (*p == '{' or *p == '[')
+                    ++depth, ++p;
+                else if (--depth == 0)
+                    return p + 1;
+                else
+                    ++p;
+            }
+        }
+
+        // Where minify() stands between two blocks
+        struct minify_state
+        {
+            bool in_string = false;
+            bool escaped = false;
+        };
+
+        HSJSON_INLINE void minify_bytes(char const *p, char const *end, span_output &out, minify_state &state)
+        {
+            for (; p != end; ++p)
+            {
+                auto c = *p;
+                if (state.in_string)
+                {
+                    out += c;
+                    if (state.escaped)
+                        state.escaped = false;
+                    else if (c == '\\')
+                        state.escaped = true;
+                    else if (c == '"')
+                        state.in_string = false;
+                }
+                else if (not is_whitespace(c))
+                {
+                    out += c;
+                    state.in_string = c == '"';
+                }
+            }
+        }
+
+#if defined(__SSE2__)
+        // One bit per byte of the 64 at <p> that is one of <chars>
+        template <char... chars>
+        std::uint64_t byte_mask(char const *p) noexcept
+        {
+            std::uint64_t mask = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                auto block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + 16 * i));
+                auto found = (... | _mm_cmpeq_epi8(block, _mm_set1_epi8(chars)));
+                mask |= static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm_movemask_epi8(found))) << (16 * i);
+            }
+            return mask;
+        }
+
+        // Bit i is the parity of the set bits at or below i
+        HSJSON_INLINE std::uint64_t prefix_xor(std::uint64_t mask) noexcept
+        {
+            for (int shift = 1; shift < 64; shift *= 2)
+                mask ^= mask << shift;
+            return mask;
+        }
+#endif
+
+        /*
+         * Strings are tracked a block at a time from the quote mask, blocks
+         * with a backslash go byte by byte since escapes change what a quote
+         * means. Blocks with nothing to drop are copied whole, others move
+         * their kept runs
+         */
+        HSJSON_INLINE void minify(char const *p, char const *end, span_output &out)
+        {
+            minify_state state{};
+#if defined(__SSE2__)
+            for (; end - p >= 64; p += 64)
+            {
+                auto backslashes = byte_mask<'\\'>(p);
+                if (backslashes or state.escaped or out.limit - out.out < 80)
+                {
+                    minify_bytes(p, p + 64, out, state);
+                    continue;
+                }
+                auto quotes = byte_mask<'"'>(p);
+                auto strings = prefix_xor(quotes) ^ (state.in_string ? ~std::uint64_t{0} : 0);
+                state.in_string = strings >> 63;
+                auto drop = byte_mask<' ', '\n', '\r', '\t'>(p) & ~strings;
+
+                if (drop == 0)
+                {
+                    std::memmove(out.out, p, 64);
+                    out.out += 64;
+                    continue;
+                }
+
+                auto o = out.out;
+                auto at = reinterpret_cast<std::uintptr_t>(o);
+                auto from = reinterpret_cast<std::uintptr_t>(p);
+                if (end - p >= 80 and (at + 16 <= from or at >= from + 80))
+                {
+                    /*
+                     * Kept runs move as whole vectors, reading and writing up
+                     * to 15 bytes past them. Output at least 16 bytes behind
+                     * the input, or apart from it, is never read afterwards
+                     */
+                    for (auto keep = ~drop; keep;)
+                    {
+                        auto start = std::countr_zero(keep);
+                        auto run = std::countr_one(keep >> start);
+                        for (int i = 0; i < run; i += 16)
+                            _mm_storeu_si128(reinterpret_cast<__m128i *>(o + i),
+                                             _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + start + i)));
+                        o += run;
+                        if (start + run == 64)
+                            break;
+                        keep &= ~std::uint64_t{0} << (start + run);
+                    }
+                }
+                else
+                    for (int i = 0; i < 64; ++i)
+                    {
+                        *o = p[i];
+                        o += not (drop >> i & 1);
+                    }
+                out.out = o;
+            }
+#endif
+            minify_bytes(p, end, out, state);
+            if (state.in_string)
+                throw parse_error;
+        }
+
+        HSJSON_INLINE bool is_delimiter(int c) noexcept
+        {
+            return is_whitespace(c) or c == ',' or c == ':' or c == '[' or c == ']' or c == '{' or c == '}' or
+                   c == '"';
+        }
+
+        template <typename Out>
+        void prettify(char const *p, char const *end, Out &out, std::size_t indent)
+        {
+            std::size_t depth = 0;
+            auto new_line = [&]()
+            {
+                out += '\n';
+                out.fill(' ', depth * indent);
+            };
+
+            for (p = skip_whitespace_run(p, end); p != end; p = skip_whitespace_run(p, end))
+            {
+                switch (auto c = *p)
+                {
+                case '{':
+                case '[':
+                {
+                    out += c;
+                    auto next = skip_whitespace_run(p + 1, end);
+                    if (next != end and *next == (c == '{' ? '}' : ']'))
+                    {
+                        out += *next;
+                        p = next + 1;
+                        break;
+                    }
+                    ++depth;
+                    new_line();
+                    p = next;
+                    break;
+                }
+                case '}':
+                case ']':
+                    if (depth == 0)
+                        throw parse_error;
+                    --depth;
+                    new_line();
+                    out += c;
+                    ++p;
+                    break;
+                case ',':
+                    out += ',';
+                    new_line();
+                    ++p;
+                    break;
+                case ':':
+                    out += ':';
+                    out += ' ';
+                    ++p;
+                    break;
+                case '"':
+                {
+                    auto start = p;
+                    p = skip_raw_string(p, end);
+                    out.append(start, p);
+                    break;
+                }
+                default:
+                {
+                    // Numbers and literals are short, a scalar loop is enough
+                    auto start = p;
+                    while (++p != end and not is_delimiter(*p))
+                        ;
+                    out.append(start, p);
+                }
+                }
+            }
+            if (depth != 0)
+                throw parse_error;
+        }
+    }
+
+    HSJSON_INLINE std::size_t minify(std::string_view text, std::span<char> out)
+    {
+        detail::span_output output{out.data(), out.data() + out.size()};
+        detail::minify(text.data(), text.data() + text.size(), output);
+        return output.out - out.data();
+    }
+
+    HSJSON_INLINE json_string minify(std::string_view text)
+    {
+        json_string result(text.size(), '\0');
+        result.resize(minify(text, result));
+        return result;
+    }
+
+    HSJSON_INLINE std::size_t prettify(std::string_view text, std::span<char> out, std::size_t indent)
+    {
+        detail::span_output output{out.data(), out.data() + out.size()};
+        detail::prettify(text.data(), text.data() + text.size(), output, indent);
+        return output.out - out.data();
+    }
+
+    HSJSON_INLINE std::size_t prettified_size(std::string_view text, std::size_t indent)
+    {
+        detail::counting_output output{};
+        detail::prettify(text.data(), text.data() + text.size(), output, indent);
+        return output.size;
+    }
+
+    HSJSON_INLINE json_string prettify(std::string_view text, std::size_t indent)
+    {
+        json_string result(prettified_size(text, indent), '\0');
+        prettify(text, result, indent);
+        return result;
+    }
+
+    HSJSON_INLINE bool
+    json_column::is_null(std::size_t row) const noexcept
+    {
+        return nulls[row / 64] >> (row % 64) & 1;
+    }
+
+    HSJSON_INLINE bool
+    json_column::boolean(std::size_t row) const noexcept
+    {
+        return booleans[row / 64] >> (row % 64) & 1;
+    }
+
+    HSJSON_INLINE std::string_view
+    json_column::string(std::size_t row) const noexcept
+    {
+        return {characters.data() + offsets[row], offsets[row + 1] - offsets[row]};
+    }
+
+    HSJSON_INLINE json_column const &
+    json_columns::operator[](std::string_view name) const
+    {
+        for (auto const &column : columns)
+            if (column.name == name)
+                return column;
+        throw invalid_access;
+    }
+
+    namespace detail
+    {
+        // Workers take a multiple of this many rows, so bitmaps of their
+        // parts concatenate word by word
+        constexpr std::size_t column_chunk_rows = 4096;
+
+        constexpr std::size_t bitmap_words(std::size_t bits) noexcept
+        {
+            return (bits + 63) / 64;
+        }
+
+        HSJSON_INLINE void set_bit(std::vector<std::uint64_t> &bits, std::size_t i)
+        {
+            if (bits.size() <= i / 64)
+                bits.resize(i / 64 + 1);
+            bits[i / 64] |= std::uint64_t{1} << (i % 64);
+        }
+
+        /*
+         * Appends records to columns member by member
+         * Records of one array tend to list members in the same order, the
+         * column after the previous match is tried first
+         */
+        class column_builder
+        {
+        public:
+            static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+            explicit column_builder(std::vector<json_column_spec> const &shape)
+                : m_inferred{shape.empty()}
+            {
+                for (auto const &spec : shape)
+                {
+                    if (spec.type == json_type::object or spec.type == json_type::array)
+                        throw conversion_error;
+                    m_columns.push_back({spec.name, spec.type});
+                    set_type(m_columns.back(), spec.type, 0);
+                    m_counts.push_back(0);
+                }
+            }
+
+            void begin_row() noexcept
+            {
+                m_hint = 0;
+                m_row_columns = m_columns.size();
+            }
+
+            void end_row()
+            {
+                // Members new in this row take key order, as json_object
+                // iterates them, so trees and text give the same columns
+                if (m_columns.size() - m_row_columns > 1)
+                {
+                    std::vector<std::size_t> order(m_columns.size() - m_row_columns);
+                    std::iota(order.begin(), order.end(), m_row_columns);
+                    std::ranges::sort(order, {}, [this](std::size_t c) -> json_string const &
+                                      { return m_columns[c].name; });
+                    std::vector<json_column> columns{};
+                    std::vector<std::size_t> counts{};
+                    for (auto c : order)
+                    {
+                        columns.push_back(std::move(m_columns[c]));
+                        counts.push_back(m_counts[c]);
+                    }
+                    std::ranges::move(columns, m_columns.begin() + m_row_columns);
+                    std::ranges::copy(counts, m_counts.begin() + m_row_columns);
+                }
+                ++m_rows;
+            }
+
+            // Column receiving a member, npos when the member is left out
+            std::size_t column(std::string_view name, json_type type)
+            {
+                auto c = find(name);
+                bool nested = type == json_type::object or type == json_type::array;
+                if (c == npos)
+                {
+                    if (not m_inferred or nested)
+                        return npos;
+                    m_columns.push_back({json_string{name}});
+                    m_counts.push_back(0);
+                    m_hint = m_columns.size();
+                    return m_columns.size() - 1;
+                }
+                if (nested)
+                {
+                    if (m_columns[c].type != json_type::null)
+                        throw conversion_error;
+                    return npos;
+                }
+                return c;
+            }
+
+            void add_number(std::size_t c, double value)
+            {
+                if (auto column = prepare(c, json_type::number))
+                    column->numbers.push_back(value);
+            }
+
+            void add_boolean(std::size_t c, bool value)
+            {
+                if (auto column = prepare(c, json_type::boolean))
+                {
+                    auto row = m_counts[c] - 1;
+                    if (column->booleans.size() <= row / 64)
+                        column->booleans.resize(row / 64 + 1);
+                    if (value)
+                        set_bit(column->booleans, row);
+                }
+            }
+
+            void add_string(std::size_t c, std::string_view value)
+            {
+                if (auto column = prepare(c, json_type::string))
+                {
+                    column->characters += value;
+                    column->offsets.push_back(column->characters.size());
+                }
+            }
+
+            // Nulls are filled in by the next value or by finish()
+            void add_null(std::size_t) noexcept
+            {
+            }
+
+            json_columns finish()
+            {
+                for (std::size_t c = 0; c < m_columns.size(); ++c)
+                {
+                    pad(c);
+                    auto &column = m_columns[c];
+                    column.nulls.resize(bitmap_words(m_rows));
+                    if (column.type == json_type::boolean)
+                        column.booleans.resize(bitmap_words(m_rows));
+                }
+                return {m_rows, std::move(m_columns)};
+            }
+
+        private:
+            std::size_t find(std::string_view name) noexcept
+            {
+                if (m_hint < m_columns.size() and m_columns[m_hint].name == name)
+                    return m_hint++;
+                for (std::size_t c = 0; c < m_columns.size(); ++c)
+                    if (m_columns[c].name == name)
+                    {
+                        m_hint = c + 1;
+                        return c;
+                    }
+                return npos;
+            }
+
+            // Placeholders for the <rows> already in a column that had no type
+            static void set_type(json_column &column, json_type type, std::size_t rows)
+            {
+                column.type = type;
+                if (type == json_type::number)
+                    column.numbers.assign(rows, 0);
+                else if (type == json_type::boolean)
+                    column.booleans.assign(bitmap_words(rows), 0);
+                else if (type == json_type::string)
+                    column.offsets.assign(rows + 1, 0);
+            }
+
+            // Brings a column up to the current row with nulls
+            void pad(std::size_t c)
+            {
+                auto &column = m_columns[c];
+                for (; m_counts[c] < m_rows; ++m_counts[c])
+                {
+                    set_bit(column.nulls, m_counts[c]);
+                    if (column.type == json_type::number)
+                        column.numbers.push_back(0);
+                    else if (column.type == json_type::string)
+                        column.offsets.push_back(column.characters.size());
+                }
+            }
+
+            // Column ready for the value of the current row, null when the
+            // row repeats a member and the first one is kept
+            json_column *prepare(std::size_t c, json_type type)
+            {
+                pad(c);
+                if (m_counts[c] > m_rows)
+                    return nullptr;
+                auto &column = m_columns[c];
+                if (column.type == json_type::null)
+                    set_type(column, type, m_counts[c]);
+                else if (column.type != type)
+                    throw conversion_error;
+                ++m_counts[c];
+                return &column;
+            }
+
+            bool m_inferred;
+            std::vector<json_column> m_columns{};
+            std::vector<std::size_t> m_counts{};
+            std::size_t m_rows = 0;
+            std::size_t m_hint = 0;
+            std::size_t m_row_columns = 0;
+        };
+
+        HSJSON_INLINE void read_record(column_builder &builder, json_value const &record)
+        {
+            if (record.type() != json_type::object)
+                throw conversion_error;
+            builder.begin_row();
+            for (auto const &[key, member] : record.as<json_object>())
+            {
+                auto type = member.type();
+                auto c = builder.column(key, type);
+                if (c == column_builder::npos)
+                    continue;
+                if (type == json_type::number)
+                    builder.add_number(c, member.as<json_number>().get_value());
+                else if (type == json_type::boolean)
+                    builder.add_boolean(c, member.as<json_boolean>().get_value());
+                else if (type == json_type::string)
+                    builder.add_string(c, member.get_as<std::string_view>());
+                else
+                    builder.add_null(c);
+            }
+            builder.end_row();
+        }
+
+        HSJSON_INLINE void read_record(column_builder &builder, json_reader &reader)
+        {
+            if (reader.peek_type() != json_type::object)
+                throw conversion_error;
+            reader.enter_object();
+            builder.begin_row();
+            while (reader.next())
+            {
+                // Members left out are skipped by next()
+                auto type = reader.peek_type();
+                auto c = builder.column(reader.key(), type);
+                if (c == column_builder::npos)
+                    continue;
+                if (type == json_type::number)
+                    builder.add_number(c, reader.read_number());
+                else if (type == json_type::boolean)
+                    builder.add_boolean(c, reader.read_boolean());
+                else if (type == json_type::string)
+                    builder.add_string(c, reader.read_string_view());
+                else
+                {
+                    reader.read_null();
+                    builder.add_null(c);
+                }
+            }
+            builder.end_row();
+        }
+
+        // Appends the rows of one worker, <part> is null when it never saw the column
+        HSJSON_INLINE void append_column(json_column &target, json_column const *part, std::size_t rows)
+        {
+            bool typed = part and part->type == target.type;
+            if (part)
+                target.nulls.insert(target.nulls.end(), part->nulls.begin(), part->nulls.end());
+            else if (rows)
+            {
+                target.nulls.resize(target.nulls.size() + bitmap_words(rows), ~std::uint64_t{0});
+                if (rows % 64)
+                    target.nulls.back() = (std::uint64_t{1} << (rows % 64)) - 1;
+            }
+
+            if (target.type == json_type::number)
+            {
+                if (typed)
+                    target.numbers.insert(target.numbers.end(), part->numbers.begin(), part->numbers.end());
+                else
+                    target.numbers.resize(target.numbers.size() + rows);
+            }
+            else if (target.type == json_type::boolean)
+            {
+                if (typed)
+                    target.booleans.insert(target.booleans.end(), part->booleans.begin(), part->booleans.end());
+                else
+                    target.booleans.resize(target.booleans.size() + bitmap_words(rows));
+            }
+            else if (target.type == json_type::string)
+            {
+                if (target.offsets.empty())
+                    target.offsets.push_back(0);
+                auto base = target.characters.size();
+                for (std::size_t row = 0; row < rows; ++row)
+                    target.offsets.push_back(base + (typed ? part->offsets[row + 1] : 0));
+                if (typed)
+                    target.characters += part->characters;
+            }
+        }
+
+        HSJSON_INLINE json_columns merge_columns(std::vector<json_columns> &parts)
+        {
+            if (parts.size() == 1)
+                return std::move(parts.front());
+
+            auto find = [](json_columns &table, std::string_view name) -> json_column *
+            {
+                for (auto &column : table.columns)
+                    if (column.name == name)
+                        return &column;
+                return nullptr;
+            };
+
+            // Union in order of first appearance, typed by the first part that has values
+            json_columns merged{};
+            for (auto &part : parts)
+                for (auto const &column : part.columns)
+                {
+                    auto target = find(merged, column.name);
+                    if (not target)
+                        merged.columns.push_back({column.name, column.type});
+                    else if (target->type == json_type::null)
+                        target->type = column.type;
+                    else if (column.type != json_type::null and column.type != target->type)
+                        throw conversion_error;
+                }
+
+            for (auto &part : parts)
+            {
+                for (auto &target : merged.columns)
+                    append_column(target, find(part, target.name), part.rows);
+                merged.rows += part.rows;
+            }
+            return merged;
+        }
+
+        /*
+         * Runs <read>(builder, first, last) over contiguous row ranges on up to
+         * <threads> threads and stitches the parts together in order
+         */
+        template <typename Read>
+        json_columns build_columns(std::vector<json_column_spec> const &shape, std::size_t rows,
+                                   std::size_t threads, Read const &read)
+        {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            auto workers = std::max<std::size_t>(1, std::min(threads, rows / column_chunk_rows));
+            auto per_worker = (rows + workers - 1) / workers;
+            per_worker = (per_worker + column_chunk_rows - 1) / column_chunk_rows * column_chunk_rows;
+
+            std::vector<json_columns> parts(workers);
+            std::vector<std::exception_ptr> errors(workers);
+            auto work = [&](std::size_t i)
+            {
+                try
+                {
+                    column_builder builder{shape};
+                    auto first = std::min(rows, i * per_worker);
+                    read(builder, first, std::min(rows, first + per_worker));
+                    parts[i] = builder.finish();
+                }
+                catch (...)
+                {
+                    errors[i] = std::current_exception();
+                }
+            };
+
+            std::vector<std::thread> pool{};
+            for (std::size_t i = 1; i < workers; ++i)
+                pool.emplace_back(work, i);
+            work(0);
+            for (auto &thread : pool)
+                thread.join();
+            for (auto const &error : errors)
+                if (error)
+                    std::rethrow_exception(error);
+            return merge_columns(parts);
+        }
+    }
+
+    HSJSON_INLINE json_columns
+    to_columns(json_array const &records, std::vector<json_column_spec> const &shape, std::size_t threads)
+    {
+        return detail::build_columns(shape, records.size(), threads,
+                             [&](detail::column_builder &builder, std::size_t first, std::size_t last)
+                             {
+                                 for (auto it = records.begin() + first; it != records.begin() + last; ++it)
+                                     detail::read_record(builder, *it);
+                             });
+    }
+
+    HSJSON_INLINE json_columns
+    to_columns(std::string_view text, std::vector<json_column_spec> const &shape, std::size_t threads,
+               parse_options const &options)
+    {
+        json_reader reader{text, options};
+        if (reader.peek_type() != json_type::array)
+            throw conversion_error;
+        reader.enter_array();
+
+        // Text shorter than two chunks of the smallest records, "{}," each,
+        // stays on one worker, so it is not worth finding the records first
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads == 1 or text.size() < 2 * detail::column_chunk_rows * std::string_view{"{},"}.size())
+        {
+            detail::column_builder builder{shape};
+            while (reader.next())
+                detail::read_record(builder, reader);
+            reader.next();
+            return builder.finish();
+        }
+
+        // Find the records with a structural scan that only matches quotes
+        // and brackets, workers then read and check them independently
+        std::vector<std::pair<std::size_t, std::size_t>> bounds{};
+        auto const begin = text.data();
+        auto const end = begin + text.size();
+        auto const skip_whitespace = [end](char const *p)
+        {
+            while (p != end and detail::is_whitespace(*p))
+                ++p;
+            return p;
+        };
+        auto p = skip_whitespace(begin + reader.offset());
+        if (p != end and *p == ']')
+            ++p;
+        else
+            while (true)
+            {
+                if (p == end)
+                    throw parse_error;
+                auto next = detail::skip_value_text(p, end);
+                if (next == p)
+                    throw parse_error;
+                bounds.emplace_back(p - begin, next - begin);
+                p = skip_whitespace(next);
+                if (p == end)
+                    throw parse_error;
+                if (*p++ == ']')
+                    break;
+                if (p[-1] != ',')
+                    throw parse_error;
+                p = skip_whitespace(p);
+            }
+        if (skip_whitespace(p) != end)
+            throw parse_error;
+
+        // Stats are not shared between workers, and records are read from
+        // inside the top level array, one level down
+        auto worker_options = options;
+        worker_options.stats = nullptr;
+        worker_options.max_depth = options.max_depth - 1;
+        return detail::build_columns(shape, bounds.size(), threads,
+                             [&](detail::column_builder &builder, std::size_t first, std::size_t last)
+                             {
+                                 json_reader record{{}, worker_options};
+                                 for (auto i = first; i < last; ++i)
+                                 {
+                                     record.reset(text.substr(bounds[i].first, bounds[i].second - bounds[i].first));
+                                     detail::read_record(builder, record);
+                                 }
+                             });
+    }
+
+    namespace detail
+    {
+        /*
+         * Whether the scalar <text> spells <value>, in which case it is kept
+         * as written, "1.50" for 1.5 or "\u00e9" for "\xc3\xa9"
+         */
+        HSJSON_INLINE bool spells(std::string_view text, json_value const &value)
+        {
+            switch (value.type())
+            {
+            case json_type::null:
+                return text == "null";
+            case json_type::boolean:
+                return text == (value.as<json_boolean>().get_value() ? "true" : "false");
+            case json_type::string:
+                if (text.empty() or text.front() != '"')
+                    return false;
+                if (text.find('\\') == std::string_view::npos)
+                    return text.substr(1, text.size() - 2) == value.get_as<std::string_view>();
+                return json_reader{text}.read_string_view() == value.get_as<std::string_view>();
+            case json_type::number:
+            {
+                if (text.empty() or (text.front() != '-' and not is_digit(text.front())))
+                    return false;
+                auto spelled = json_reader{text}.read_number();
+                auto number = value.as<json_number>().get_value();
+                return spelled == number and std::signbit(spelled) == std::signbit(number);
+            }
+            default:
+                return false;
+            }
+        }
+
+        // Like skip_value_text(), containers parsed from <p> know their extent
+        HSJSON_INLINE char const *skip_member_text(json_value const &member, char const *p, char const *end)
+        {
+            std::string_view source{};
+            if (member.type() == json_type::object)
+                source = member.as<json_object>().source();
+            else if (member.type() == json_type::array)
+                source = member.as<json_array>().source();
+            return source.data() == p ? p + source.size() : skip_value_text(p, end);
+        }
+    }
+
+#ifdef NDEBUG
+#define WRITER_CHECK(condition)
+#else
+#define WRITER_CHECK(condition) \
+    if (not(condition))         \
+        throw write_error
+#endif
+
+    HSJSON_INLINE
+    json_writer::json_writer(sink output, std::span<char> buffer)
+        : m_sink{std::move(output)}, m_buffer{buffer}
+    {
+    }
+
+    HSJSON_INLINE
+    json_writer::json_writer(sink output, std::size_t chunk_size)
+        : m_sink{std::move(output)}, m_owned{new char[chunk_size]}, m_buffer{m_owned.get(), chunk_size}
+    {
+    }
+
+    HSJSON_INLINE
+    json_writer::~json_writer()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    HSJSON_INLINE json_writer::sink
+    json_writer::fd_sink(int fd)
+    {
+        return [fd](std::string_view data)
+        {
+            while (not data.empty())
+            {
+                auto n = ::write(fd, data.data(), data.size());
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    throw write_error;
+                }
+                data.remove_prefix(n);
+            }
+        };
+    }
+
+    HSJSON_INLINE void
+    json_writer::begin_object()
+    {
+        before_value();
+        put('{');
+        m_stack.push_back('{');
+        m_comma = false;
+    }
+
+    HSJSON_INLINE void
+    json_writer::end_object()
+    {
+        WRITER_CHECK(not m_stack.empty() and m_stack.back() == '{' and not m_key_pending);
+        m_stack.pop_back();
+        put('}');
+        after_value();
+    }
+
+    HSJSON_INLINE void
+    json_writer::begin_array()
+    {
+        before_value();
+        put('[');
+        m_stack.push_back('[');
+        m_comma = false;
+    }
+
+    HSJSON_INLINE void
+    json_writer::end_array()
+    {
+        WRITER_CHECK(not m_stack.empty() and m_stack.back() == '[');
+        m_stack.pop_back();
+        put(']');
+        after_value();
+    }
+
+    HSJSON_INLINE void
+    json_writer::key(std::string_view name)
+    {
+        WRITER_CHECK(not m_stack.empty() and m_stack.back() == '{' and not m_key_pending);
+        if (m_comma)
+            put(',');
+        write_string(name);
+        put(':');
+        m_key_pending = true;
+    }
+
+    HSJSON_INLINE void
+    json_writer::value(std::string_view string)
+    {
+        before_value();
+        write_string(string);
+        after_value();
+    }
+
+    HSJSON_INLINE void
+    json_writer::value(json_string const &string)
+    {
+        value(std::string_view{string});
+    }
+
+    HSJSON_INLINE void
+    json_writer::value(char const *string)
+    {
+        value(std::string_view{string});
+    }
+
+    HSJSON_INLINE void
+    json_writer::value(double number)
+    {
+        if (not std::isfinite(number))
+            throw write_error;
+        before_value();
+        write_number(number);
+        after_value();
+    }
+
+#define WRITER_INTEGER(type)                  \
+    HSJSON_INLINE void                        \
+    json_writer::value(type number)           \
+    {                                         \
+        before_value();                       \
+        write_number(number);                 \
+        after_value();                        \
+    }
+
+    WRITER_INTEGER(int);
+    WRITER_INTEGER(long);
+    WRITER_INTEGER(long long);
+    WRITER_INTEGER(unsigned);
+    WRITER_INTEGER(unsigned long);
+    WRITER_INTEGER(unsigned long long);
+
+#undef WRITER_INTEGER
+
+    HSJSON_INLINE void
+    json_writer::value(bool boolean)
+    {
+        before_value();
+        put(boolean ? std::string_view{"true"} : std::string_view{"false"});
+        after_value();
+    }
+
+    HSJSON_INLINE void
+    json_writer::value(std::nullptr_t)
+    {
+        before_value();
+        put(std::string_view{"null"});
+        after_value();
+    }
+
+    HSJSON_INLINE void
+    json_writer::value(json_value const &tree)
+    {
+        switch (tree.type())
+        {
+        case json_type::null:
+            value(nullptr);
+            break;
+        case json_type::boolean:
+            value(tree.as<json_boolean>().get_value());
+            break;
+        case json_type::number:
+            value(tree.as<json_number>().get_value());
+            break;
+        case json_type::string:
+            value(tree.get_as<std::string_view>());
+            break;
+        case json_type::object:
+            if (auto const &object = tree.as<json_object>(); object.m_source)
+            {
+                write_source(object);
+                break;
+            }
+            begin_object();
+            for (auto const &[name, member] : tree.as<json_object>())
+            {
+                key(name);
+                value(member);
+            }
+            end_object();
+            break;
+        case json_type::array:
+            if (auto const &array = tree.as<json_array>(); not array.source().empty())
+            {
+                write_source(array);
+                break;
+            }
+            begin_array();
+            detail::for_each_element(tree.as<json_array>(), [this](json_value const &element) { value(element); });
+            end_array();
+            break;
+        }
+    }
+
+    /*
+     * Copies the input text between members as is, so whitespace, key
+     * spelling and member order stay; only values that changed since the
+     * parse are encoded again, and members added since come last
+     */
+    HSJSON_INLINE void
+    json_writer::write_source(json_object const &object)
+    {
+        auto text = object.source();
+        before_value();
+        if (not object.m_modified)
+        {
+            put(text);
+            after_value();
+            return;
+        }
+
+        m_stack.push_back('{');
+        auto end = text.data() + text.size() - 1;
+        auto run = text.data();
+        auto tail = text.data() + 1;
+        json_string name{};
+        std::vector<json_value const *> seen{};
+        for (auto p = detail::skip_whitespace_run(tail, end); p != end and *p == '"';)
+        {
+            auto after_key = detail::skip_raw_string(p, end);
+            std::string_view spelled{p, static_cast<std::size_t>(after_key - p)};
+            if (spelled.find('\\') == std::string_view::npos)
+                name.assign(spelled.substr(1, spelled.size() - 2));
+            else
+                name.assign(json_reader{spelled}.read_string_view());
+            p = detail::skip_whitespace_run(after_key, end);
+            if (p == end or *p != ':')
+                throw parse_error;
+            p = detail::skip_whitespace_run(p + 1, end);
+            if (p == end)
+                throw parse_error;
+
+            auto it = object.m_attributes.find(name);
+            if (it == object.m_attributes.end())
+                throw write_error;
+            seen.push_back(&it->second);
+            auto next = detail::skip_member_text(it->second, p, end);
+            put({run, static_cast<std::size_t>(p - run)});
+            m_key_pending = true;
+            write_member(it->second, {p, static_cast<std::size_t>(next - p)});
+
+            run = tail = next;
+            p = detail::skip_whitespace_run(next, end);
+            if (p != end and *p == ',')
+                p = detail::skip_whitespace_run(p + 1, end);
+        }
+        put({run, static_cast<std::size_t>(tail - run)});
+
+        // Kept text has no repeated keys, members it lacks were added since
+        std::sort(seen.begin(), seen.end());
+        if (seen.size() < object.m_attributes.size())
+        {
+            m_comma = not seen.empty();
+            for (auto const &[added, member] : object.m_attributes)
+                if (not std::binary_search(seen.begin(), seen.end(), &member))
+                {
+                    key(added);
+                    value(member);
+                }
+        }
+        put({tail, static_cast<std::size_t>(end + 1 - tail)});
+        m_stack.pop_back();
+        after_value();
+    }
+
+    HSJSON_INLINE void
+    json_writer::write_source(json_array const &array)
+    {
+        auto text = array.source();
+        before_value();
+        if (not array.modified())
+        {
+            put(text);
+            after_value();
+            return;
+        }
+
+        m_stack.push_back('[');
+        auto end = text.data() + text.size() - 1;
+        auto run = text.data();
+        auto tail = text.data() + 1;
+        auto element = array.begin();
+        std::size_t index = 0;
+        for (auto p = detail::skip_whitespace_run(tail, end); p != end and index < array.size(); ++index, ++element)
+        {
+            auto next = detail::skip_member_text(*element, p, end);
+            put({run, static_cast<std::size_t>(p - run)});
+            m_comma = false;
+            write_member(*element, {p, static_cast<std::size_t>(next - p)});
+
+            run = tail = next;
+            p = detail::skip_whitespace_run(next, end);
+            if (p != end and *p == ',')
+                p = detail::skip_whitespace_run(p + 1, end);
+        }
+        put({run, static_cast<std::size_t>(tail - run)});
+
+        m_comma = index != 0;
+        for (; index < array.size(); ++index, ++element)
+            value(*element);
+        put({tail, static_cast<std::size_t>(end + 1 - tail)});
+        m_stack.pop_back();
+        after_value();
+    }
+
+    /*
+     * One value of a container written from its source, <text> being what
+     * the input had in its place
+     */
+    HSJSON_INLINE void
+    json_writer::write_member(json_value const &member, std::string_view text)
+    {
+        auto type = member.type();
+        if (type != json_type::object and type != json_type::array and detail::spells(text, member))
+        {
+            before_value();
+            put(text);
+            after_value();
+        }
+        else
+            value(member);
+    }
+
+    HSJSON_INLINE void
+    json_writer::flush()
+    {
+        if (m_used)
+        {
+            // Counted first so a throwing sink does not see the chunk twice
+            auto used = std::exchange(m_used, 0);
+            m_flushed += used;
+            m_sink({m_buffer.data(), used});
+        }
+    }
+
+    HSJSON_INLINE std::size_t
+    json_writer::bytes_written() const noexcept
+    {
+        return m_flushed + m_used;
+    }
+
+    HSJSON_INLINE void
+    json_writer::before_value()
+    {
+        WRITER_CHECK(not m_done);
+        if (m_stack.empty())
+            return;
+        if (m_stack.back() == '{')
+        {
+            WRITER_CHECK(m_key_pending);
+            m_key_pending = false;
+        }
+        else if (m_comma)
+            put(',');
+    }
+
+    HSJSON_INLINE void
+    json_writer::after_value() noexcept
+    {
+        m_comma = true;
+        m_done = m_stack.empty();
+    }
+
+    HSJSON_INLINE void
+    json_writer::put(char c)
+    {
+        if (m_used == m_buffer.size())
+            flush();
+        m_buffer[m_used++] = c;
+    }
+
+    HSJSON_INLINE void
+    json_writer::put(std::string_view data)
+    {
+        if (data.size() > m_buffer.size() - m_used)
+        {
+            flush();
+            // Too large to buffer, goes to the sink as is
+            if (data.size() >= m_buffer.size())
+            {
+                m_flushed += data.size();
+                m_sink(data);
+                return;
+            }
+        }
+        std::memcpy(m_buffer.data() + m_used, data.data(), data.size());
+        m_used += data.size();
+    }
+
+    HSJSON_INLINE void
+    json_writer::write_string(std::string_view string)
+    {
+        static constexpr char hex[] = "0123456789abcdef";
+        put('"');
+        auto p = string.data();
+        auto end = p + string.size();
+        while (p != end)
+        {
+            // Runs that need no escape are copied in one piece, UTF-8
+            // sequences pass through
+            auto run = detail::scan_string_run(p, end);
+            while (run != end and static_cast<unsigned char>(*run) >= 0x80)
+                run = detail::scan_string_run(run + 1, end);
+            put(std::string_view{p, static_cast<std::size_t>(run - p)});
+            if (run == end)
+                break;
+
+            auto c = static_cast<unsigned char>(*run);
+            switch (c)
+            {
+            case '"':
+                put(std::string_view{"\\\""});
+                break;
+            case '\\':
+                put(std::string_view{"\\\\"});
+                break;
+            case '\b':
+                put(std::string_view{"\\b"});
+                break;
+            case '\f':
+                put(std::string_view{"\\f"});
+                break;
+            case '\n':
+                put(std::string_view{"\\n"});
+                break;
+            case '\r':
+                put(std::string_view{"\\r"});
+                break;
+            case '\t':
+                put(std::string_view{"\\t"});
+                break;
+            default:
+                char escape[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                put(std::string_view{escape, sizeof escape});
+                break;
+            }
+            p = run + 1;
+        }
+        put('"');
+    }
+
+    template <typename T>
+    void json_writer::write_number(T number)
+    {
+        // Shortest text that reads back to the same double
+        char text[32];
+        auto [end, error] = std::to_chars(text, text + sizeof text, number);
+        put(std::string_view{text, static_cast<std::size_t>(end - text)});
+    }
+
+#undef WRITER_CHECK
+
+    HSJSON_INLINE json_string serialize(json_value const &value)
+    {
+        json_string text{};
+        json_writer writer{[&text](std::string_view data) { text += data; }};
+        writer.value(value);
+        writer.flush();
+        return text;
+    }
+
+    namespace detail
+    {
+        // Containers are split in runs of no fewer elements than this, and
+        // no more than the second so few runs are held in memory at once
+        constexpr std::size_t serialize_run_elements = 32;
+        constexpr std::size_t serialize_run_max_elements = 1024;
+        // Containers deeper than this are written whole
+        constexpr std::size_t serialize_plan_depth = 8;
+
+        /*
+         * Text of a tree in order: glue written while planning, values and
+         * runs of elements written by the workers. Runs are written as a
+         * container and lose their first and last byte when joined
+         */
+        struct serialize_part
+        {
+            json_string text{};
+            bool run = false;
+        };
+
+        struct serialize_job
+        {
+            std::size_t part = 0;
+            json_value const *value = nullptr;
+            json_array const *array = nullptr;
+            std::size_t first = 0;
+            std::size_t last = 0;
+            json_object::const_iterator from{};
+            json_object::const_iterator to{};
+        };
+
+        struct serialize_plan
+        {
+            std::vector<serialize_part> parts{};
+            std::vector<serialize_job> jobs{};
+            std::size_t runs = 1;
+
+            void glue(std::string_view text)
+            {
+                if (parts.empty() or (not jobs.empty() and jobs.back().part == parts.size() - 1))
+                    parts.emplace_back();
+                parts.back().text += text;
+            }
+
+            serialize_job &job(bool run)
+            {
+                parts.push_back({{}, run});
+                return jobs.emplace_back(serialize_job{parts.size() - 1});
+            }
+        };
+
+        /*
+         * Containers parsed with <keep_source> are written whole, their
+         * text is copied and may not be split
+         */
+        HSJSON_INLINE std::size_t splittable_size(json_value const &value) noexcept
+        {
+            if (value.type() == json_type::object)
+            {
+                auto const &object = value.as<json_object>();
+                return object.source().empty() ? static_cast<std::size_t>(object.size()) : 0;
+            }
+            if (value.type() == json_type::array)
+            {
+                auto const &array = value.as<json_array>();
+                return array.source().empty() ? array.size() : 0;
+            }
+            return 0;
+        }
+
+        // Whether <value> holds a container worth splitting
+        HSJSON_INLINE bool worth_splitting(json_value const &value, std::size_t depth)
+        {
+            auto size = splittable_size(value);
+            if (size >= 2 * serialize_run_elements)
+                return true;
+            if (size == 0 or depth == serialize_plan_depth)
+                return false;
+            if (value.type() == json_type::object)
+                return std::any_of(value.as<json_object>().begin(), value.as<json_object>().end(),
+                                   [depth](auto const &member) { return worth_splitting(member.second, depth + 1); });
+            // Elements of packed arrays are scalars
+            auto const &array = value.as<json_array>();
+            return not array.packed() and std::any_of(array.begin(), array.end(), [depth](json_value const &element)
+                                                      { return worth_splitting(element, depth + 1); });
+        }
+
+        HSJSON_INLINE void plan_value(serialize_plan &plan, json_value const &value, std::size_t depth)
+        {
+            if (not worth_splitting(value, depth))
+            {
+                if (value.type() != json_type::object and value.type() != json_type::array)
+                    plan.glue(serialize(value));
+                else
+                    plan.job(false).value = &value;
+                return;
+            }
+
+            auto size = splittable_size(value);
+            auto per_run = std::clamp((size + plan.runs - 1) / plan.runs, serialize_run_elements,
+                                      serialize_run_max_elements);
+            if (value.type() == json_type::array)
+            {
+                auto const &array = value.as<json_array>();
+                plan.glue("[");
+                if (size >= 2 * serialize_run_elements)
+                    for (std::size_t first = 0; first < size; first += per_run)
+                    {
+                        if (first)
+                            plan.glue(",");
+                        auto &job = plan.job(true);
+                        job.array = &array;
+                        job.first = first;
+                        job.last = std::min(size, first + per_run);
+                    }
+                else
+                    for (auto it = array.begin(); it != array.end(); ++it)
+                    {
+                        if (it != array.begin())
+                            plan.glue(",");
+                        plan_value(plan, *it, depth + 1);
+                    }
+                plan.glue("]");
+                return;
+            }
+
+            auto const &object = value.as<json_object>();
+            plan.glue("{");
+            if (size >= 2 * serialize_run_elements)
+            {
+                auto it = object.begin();
+                for (std::size_t first = 0; first < size; first += per_run)
+                {
+                    if (first)
+                        plan.glue(",");
+                    auto &job = plan.job(true);
+                    job.from = it;
+                    std::advance(it, std::min(per_run, size - first));
+                    job.to = it;
+                }
+            }
+            else
+                for (auto it = object.begin(); it != object.end(); ++it)
+                {
+                    if (it != object.begin())
+                        plan.glue(",");
+                    plan.glue(serialize(json_value{it->first}));
+                    plan.glue(":");
+                    plan_value(plan, it->second, depth + 1);
+                }
+            plan.glue("}");
+        }
+
+        HSJSON_INLINE void run_job(serialize_job const &job, json_string &text)
+        {
+            json_writer writer{[&text](std::string_view data) { text += data; }};
+            if (job.value)
+                writer.value(*job.value);
+            else if (job.array)
+            {
+                writer.begin_array();
+                for_each_element(*job.array, job.first, job.last,
+                                 [&writer](json_value const &element) { writer.value(element); });
+                writer.end_array();
+            }
+            else
+            {
+                writer.begin_object();
+                for (auto it = job.from; it != job.to; ++it)
+                {
+                    writer.key(it->first);
+                    writer.value(it->second);
+                }
+                writer.end_object();
+            }
+            writer.flush();
+        }
+
+        HSJSON_INLINE std::string_view joined(serialize_part const &part) noexcept
+        {
+            std::string_view text{part.text};
+            return part.run ? text.substr(1, text.size() - 2) : text;
+        }
+
+        /*
+         * Plans <value> and writes its parts on up to <threads> workers while
+         * the calling thread hands finished parts to <emit> in order, as
+         * many at a time as are ready. Workers stay at most a few runs each
+         * ahead of the last part handed over, which is freed right after.
+         * Returns false, having done nothing, when the tree is better written
+         * on the calling thread
+         */
+        template <typename Emit>
+        bool serialize_ordered(json_value const &value, std::size_t threads, Emit const &emit)
+        {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            if (threads == 1 or not worth_splitting(value, 0))
+                return false;
 
-                    SKIP_WHITESPACE();
+            // A few runs per thread even out elements of uneven size
+            serialize_plan plan{};
+            plan.runs = threads * 4;
+            plan_value(plan, value, 0);
+            auto const &jobs = plan.jobs;
+            auto &parts = plan.parts;
+            auto const window = threads * 4;
 
-                    auto value{parse_value(s)};
+            std::mutex mutex{};
+            std::condition_variable changed{};
+            std::vector<char> done(jobs.size());
+            std::size_t next = 0;
+            std::size_t emitted = 0;
+            std::exception_ptr error{};
+            bool stop = false;
 
-                    object[key] = value;
-                    last_attribute = true;
+            auto work = [&]()
+            {
+                std::unique_lock lock{mutex};
+                while (true)
+                {
+                    changed.wait(lock, [&] { return stop or next == jobs.size() or next < emitted + window; });
+                    if (stop or next == jobs.size())
+                        return;
+                    auto job = next++;
+                    lock.unlock();
+                    try
+                    {
+                        run_job(jobs[job], parts[jobs[job].part].text);
+                    }
+                    catch (...)
+                    {
+                        lock.lock();
+                        if (not error)
+                            error = std::current_exception();
+                        stop = true;
+                        changed.notify_all();
+                        return;
+                    }
+                    lock.lock();
+                    done[job] = true;
+                    changed.notify_all();
                 }
-                else if (c == ',')
+            };
+
+            std::vector<std::thread> pool{};
+            auto finish = [&]()
+            {
                 {
-                    last_attribute = false;
-                    CONSUME();
+                    std::lock_guard lock{mutex};
+                    stop = true;
                 }
-                else if (c == '}')
+                changed.notify_all();
+                for (auto &thread : pool)
+                    thread.join();
+            };
+
+            try
+            {
+                for (std::size_t i = 0; i < std::min(threads, jobs.size()); ++i)
+                    pool.emplace_back(work);
+
+                std::size_t part = 0;
+                std::size_t job = 0;
+                auto ready = [&] { return job == jobs.size() or jobs[job].part != part or done[job]; };
+                while (part < parts.size())
                 {
-                    if (not last_attribute)
-                        throw parse_error;
-                    CONSUME();
-                    break;
+                    auto first = part;
+                    {
+                        std::unique_lock lock{mutex};
+                        changed.wait(lock, [&] { return stop or ready(); });
+                        if (stop)
+                            break;
+                        for (; part < parts.size() and ready(); ++part)
+                            if (job < jobs.size() and jobs[job].part == part)
+                                ++job;
+                    }
+                    emit(std::span<serialize_part const>{parts.data() + first, part - first});
+                    for (auto i = first; i < part; ++i)
+                        json_string{}.swap(parts[i].text);
+                    {
+                        std::lock_guard lock{mutex};
+                        emitted = job;
+                    }
+                    changed.notify_all();
                 }
-                else
+            }
+            catch (...)
+            {
+                finish();
+                throw;
+            }
+            finish();
+            if (error)
+                std::rethrow_exception(error);
+            return true;
+        }
+    }
+
+    HSJSON_INLINE json_string serialize(json_value const &value, std::size_t threads)
+    {
+        json_string text{};
+        auto split = detail::serialize_ordered(value, threads, [&text](std::span<detail::serialize_part const> parts)
+                                               {
+                                                   for (auto const &part : parts)
+                                                       text += detail::joined(part);
+                                               });
+        if (not split)
+            return serialize(value);
+        return text;
+    }
+
+    HSJSON_INLINE void serialize_to_fd(int fd, json_value const &value, std::size_t threads)
+    {
+        std::vector<iovec> pending{};
+        auto write = [fd, &pending](std::span<detail::serialize_part const> parts)
+        {
+            pending.clear();
+            for (auto const &part : parts)
+                if (auto text = detail::joined(part); not text.empty())
+                    pending.push_back({const_cast<char *>(text.data()), text.size()});
+
+            // Partial writes leave the first buffers written and one cut short
+            for (auto first = pending.begin(); first != pending.end();)
+            {
+                auto count = std::min<std::ptrdiff_t>(pending.end() - first, IOV_MAX);
+                auto n = ::writev(fd, &*first, static_cast<int>(count));
+                if (n < 0)
                 {
-                    throw parse_error;
+                    if (errno == EINTR)
+                        continue;
+                    throw write_error;
+                }
+                auto written = static_cast<std::size_t>(n);
+                for (; first != pending.end() and written >= first->iov_len; ++first)
+                    written -= first->iov_len;
+                if (first != pending.end())
+                {
+                    first->iov_base = static_cast<char *>(first->iov_base) + written;
+                    first->iov_len -= written;
                 }
             }
+        };
+        if (detail::serialize_ordered(value, threads, write))
+            return;
 
-            return object;
+        json_writer writer{json_writer::fd_sink(fd), 1 << 16};
+        writer.value(value);
+        writer.flush();
+    }
+
+    namespace detail
+    {
+        /*
+         * Tape layout, every part starts on a multiple of 8 bytes:
+         *   header  "HSJTAPE1", byte order mark, tape size, root reference
+         *   number  double
+         *   string  length, bytes, NUL
+         *   array   count, element references
+         *   object  count, index slots, (key offset, value reference) pairs
+         *           sorted by key, then index slots of 32 bits each
+         * A reference is the offset of its part with the type in the low
+         * three bits, null and booleans have no part
+         */
+        enum tape_tag : std::uint64_t
+        {
+            tape_null,
+            tape_false,
+            tape_true,
+            tape_number,
+            tape_string,
+            tape_array,
+            tape_object,
+        };
+
+        constexpr std::uint64_t tape_tag_mask = 7;
+        constexpr char tape_magic[8] = {'H', 'S', 'J', 'T', 'A', 'P', 'E', '1'};
+        constexpr std::uint64_t tape_byte_order = 0x0102030405060708;
+        constexpr std::size_t tape_header_size = 32;
+
+        // Objects this large get a hash index, smaller ones are searched
+        constexpr std::size_t tape_index_threshold = 16;
+
+        HSJSON_INLINE std::uint64_t tape_word(char const *tape, std::uint64_t offset) noexcept
+        {
+            std::uint64_t word;
+            std::memcpy(&word, tape + offset, sizeof(word));
+            return word;
         }
 
-        json_array parse_array(json_stream &s)
+        HSJSON_INLINE std::string_view tape_text(char const *tape, std::uint64_t offset) noexcept
         {
-            json_array array{};
+            return {tape + offset + 8, tape_word(tape, offset)};
+        }
+
+        class tape_builder
+        {
+        public:
+            std::vector<char> finish(json_value const &root)
+            {
+                m_bytes.assign(tape_header_size, '\0');
+                auto ref = add(root);
+                std::memcpy(m_bytes.data(), tape_magic, sizeof(tape_magic));
+                put(8, tape_byte_order);
+                put(16, m_bytes.size());
+                put(24, ref);
+                return std::move(m_bytes);
+            }
 
-            SKIP_WHITESPACE();
+        private:
+            void put(std::uint64_t offset, std::uint64_t word) noexcept
+            {
+                std::memcpy(m_bytes.data() + offset, &word, sizeof(word));
+            }
 
-            bool last_attribute = true;
-            char c;
-            if (s.peek() != '[')
-                throw parse_error;
-            CONSUME();
+            // Zero filled room for <n> bytes, padded to a multiple of 8
+            std::uint64_t allocate(std::size_t n)
+            {
+                auto offset = m_bytes.size();
+                m_bytes.resize(offset + (n + 7) / 8 * 8);
+                return offset;
+            }
 
-            for (c = s.peek(); c != json_stream::traits_type::eof(); c = s.peek())
+            std::uint64_t add_string(std::string_view string)
             {
-                if (std::isspace(c))
+                auto [it, inserted] = m_strings.try_emplace(string, 0);
+                if (inserted)
                 {
-                    CONSUME();
-                    continue;
+                    it->second = allocate(8 + string.size() + 1);
+                    put(it->second, string.size());
+                    std::memcpy(m_bytes.data() + it->second + 8, string.data(), string.size());
                 }
-                else if (c == ',')
+                return it->second;
+            }
+
+            std::uint64_t add(json_value const &value)
+            {
+                switch (value.type())
+                {
+                case json_type::null:
+                    return tape_null;
+                case json_type::boolean:
+                    return value.get_as<json_boolean>().get_value() ? tape_true : tape_false;
+                case json_type::number:
                 {
-                    CONSUME();
-                    last_attribute = false;
+                    auto offset = allocate(8);
+                    auto number = value.get_as<json_number>().get_value();
+                    std::memcpy(m_bytes.data() + offset, &number, sizeof(number));
+                    return offset | tape_number;
                 }
-                else if (c == ']')
+                case json_type::string:
+                    return add_string(value.get_as<std::string_view>()) | tape_string;
+                case json_type::array:
                 {
-                    if (not last_attribute)
-                        throw parse_error;
-                    CONSUME();
-                    break;
+                    // Children first, so the array is written in one piece
+                    auto const &array = value.as<json_array>();
+                    std::vector<std::uint64_t> refs;
+                    refs.reserve(array.size());
+                    for_each_element(array, [&](json_value const &element) { refs.push_back(add(element)); });
+
+                    auto offset = allocate(8 * (1 + refs.size()));
+                    put(offset, refs.size());
+                    for (std::size_t i = 0; i < refs.size(); ++i)
+                        put(offset + 8 + 8 * i, refs[i]);
+                    return offset | tape_array;
                 }
-                else
+                default:
                 {
-                    auto res{parse_value(s)};
-                    array.push_back(res);
-                    last_attribute = true;
+                    // Map order is key order, which lookups search by
+                    auto const &object = value.as<json_object>();
+                    std::vector<std::pair<std::uint64_t, std::uint64_t>> members;
+                    std::vector<std::uint64_t> hashes;
+                    for (auto const &[key, member] : object)
+                    {
+                        members.emplace_back(add_string(key), add(member));
+                        hashes.push_back(hash_bytes(key));
+                    }
+
+                    auto count = members.size();
+                    std::size_t slots = count >= tape_index_threshold ? std::bit_ceil(2 * count) : 0;
+                    auto offset = allocate(16 + 16 * count + 4 * slots);
+                    put(offset, count);
+                    put(offset + 8, slots);
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        put(offset + 16 + 16 * i, members[i].first);
+                        put(offset + 24 + 16 * i, members[i].second);
+                    }
+                    // Open addressing, a slot holds a member index plus one
+                    auto index = offset + 16 + 16 * count;
+                    for (std::size_t i = 0; i < count and slots; ++i)
+                    {
+                        auto slot = hashes[i] & (slots - 1);
+                        std::uint32_t taken;
+                        while (std::memcpy(&taken, m_bytes.data() + index + 4 * slot, 4), taken)
+                            slot = (slot + 1) & (slots - 1);
+                        auto entry = static_cast<std::uint32_t>(i + 1);
+                        std::memcpy(m_bytes.data() + index + 4 * slot, &entry, 4);
+                    }
+                    return offset | tape_object;
+                }
                 }
             }
-            return array;
-        }
 
-        json_string parse_string(json_stream &s)
+            std::vector<char> m_bytes;
+            std::unordered_map<std::string_view, std::uint64_t> m_strings;
+        };
+    }
+
+    HSJSON_INLINE std::vector<char> make_tape(json_value const &value)
+    {
+        return detail::tape_builder{}.finish(value);
+    }
+
+    HSJSON_INLINE json_view::json_view(std::span<char const> tape)
+        : m_tape{tape.data()}
+    {
+        if (tape.size() < detail::tape_header_size or std::memcmp(m_tape, detail::tape_magic, sizeof(detail::tape_magic)) != 0 or
+            detail::tape_word(m_tape, 8) != detail::tape_byte_order or detail::tape_word(m_tape, 16) > tape.size())
+            throw parse_error;
+        m_ref = detail::tape_word(m_tape, 24);
+    }
+
+    HSJSON_INLINE json_view::json_view(char const *tape, std::uint64_t ref) noexcept
+        : m_tape{tape}, m_ref{ref}
+    {
+    }
+
+    HSJSON_INLINE json_type
+    json_view::type() const noexcept
+    {
+        switch (m_ref & detail::tape_tag_mask)
         {
+        case detail::tape_false:
+        case detail::tape_true:
+            return json_type::boolean;
+        case detail::tape_number:
+            return json_type::number;
+        case detail::tape_string:
+            return json_type::string;
+        case detail::tape_array:
+            return json_type::array;
+        case detail::tape_object:
+            return json_type::object;
+        default:
+            return json_type::null;
+        }
+    }
 
-            SKIP_WHITESPACE();
-            char c;
-            if (s.peek() != '"')
-                throw parse_error;
-            CONSUME();
+    template <>
+    HSJSON_INLINE json_null json_view::get_as<json_null>() const
+    {
+        if ((m_ref & detail::tape_tag_mask) != detail::tape_null)
+            throw conversion_error;
+        return {};
+    }
+
+    template <>
+    HSJSON_INLINE json_boolean json_view::get_as<json_boolean>() const
+    {
+        auto tag = m_ref & detail::tape_tag_mask;
+        if (tag != detail::tape_false and tag != detail::tape_true)
+            throw conversion_error;
+        return tag == detail::tape_true;
+    }
+
+    template <>
+    HSJSON_INLINE json_number json_view::get_as<json_number>() const
+    {
+        if ((m_ref & detail::tape_tag_mask) != detail::tape_number)
+            throw conversion_error;
+        double number;
+        std::memcpy(&number, m_tape + (m_ref & ~detail::tape_tag_mask), sizeof(number));
+        return number;
+    }
+
+    template <>
+    HSJSON_INLINE std::string_view json_view::get_as<std::string_view>() const
+    {
+        if ((m_ref & detail::tape_tag_mask) != detail::tape_string)
+            throw conversion_error;
+        return detail::tape_text(m_tape, m_ref & ~detail::tape_tag_mask);
+    }
+
+    template <>
+    HSJSON_INLINE json_string json_view::get_as<json_string>() const
+    {
+        return json_string{get_as<std::string_view>()};
+    }
+
+    HSJSON_INLINE std::uint64_t
+    json_view::container() const
+    {
+        auto tag = m_ref & detail::tape_tag_mask;
+        if (tag != detail::tape_array and tag != detail::tape_object)
+            throw conversion_error;
+        return m_ref & ~detail::tape_tag_mask;
+    }
+
+    HSJSON_INLINE std::size_t
+    json_view::size() const
+    {
+        return detail::tape_word(m_tape, container());
+    }
+
+    HSJSON_INLINE json_view
+    json_view::get_at(std::size_t index) const
+    {
+        auto offset = container();
+        if (index >= detail::tape_word(m_tape, offset))
+            throw invalid_access;
+        if ((m_ref & detail::tape_tag_mask) == detail::tape_array)
+            return {m_tape, detail::tape_word(m_tape, offset + 8 + 8 * index)};
+        return {m_tape, detail::tape_word(m_tape, offset + 24 + 16 * index)};
+    }
+
+    HSJSON_INLINE std::string_view
+    json_view::key_at(std::size_t index) const
+    {
+        if ((m_ref & detail::tape_tag_mask) != detail::tape_object)
+            throw conversion_error;
+        auto offset = m_ref & ~detail::tape_tag_mask;
+        if (index >= detail::tape_word(m_tape, offset))
+            throw invalid_access;
+        return detail::tape_text(m_tape, detail::tape_word(m_tape, offset + 16 + 16 * index));
+    }
 
-            json_string string{};
+    HSJSON_INLINE std::size_t
+    json_view::find(std::string_view name) const
+    {
+        if ((m_ref & detail::tape_tag_mask) != detail::tape_object)
+            throw conversion_error;
+        auto offset = m_ref & ~detail::tape_tag_mask;
+        std::size_t count = detail::tape_word(m_tape, offset);
+        auto slots = detail::tape_word(m_tape, offset + 8);
+        auto key = [&](std::size_t i)
+        { return detail::tape_text(m_tape, detail::tape_word(m_tape, offset + 16 + 16 * i)); };
 
-            for (c = s.peek(); c != json_stream::traits_type::eof(); c = s.peek())
+        if (slots)
+        {
+            auto index = m_tape + offset + 16 + 16 * count;
+            for (auto slot = detail::hash_bytes(name) & (slots - 1);; slot = (slot + 1) & (slots - 1))
             {
-                if (c == '"')
-                {
-                    CONSUME();
-                    return string;
-                }
-                else
-                {
-                    string += c;
-                    CONSUME();
-                }
+                std::uint32_t entry;
+                std::memcpy(&entry, index + 4 * slot, sizeof(entry));
+                if (entry == 0)
+                    return count;
+                if (key(entry - 1) == name)
+                    return entry - 1;
             }
-            throw parse_error;
         }
 
-        json_number parse_number(json_stream &s)
+        std::size_t first = 0, last = count;
+        while (first < last)
         {
-            auto parse_fraction = [](json_stream &s, std::stringstream &os)
-            {
-                char c = s.peek();
-                if (c != '.')
-                    return;
-                os << c;
-                CONSUME();
+            auto middle = first + (last - first) / 2;
+            auto order = key(middle).compare(name);
+            if (order == 0)
+                return middle;
+            if (order < 0)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        return count;
+    }
 
-                c = s.peek();
-                if (not std::isdigit(c))
-                    throw parse_error;
-                os << c;
-                CONSUME();
+    HSJSON_INLINE bool
+    json_view::has_attribute(std::string_view name) const
+    {
+        return find(name) != size();
+    }
 
-                for (c = s.peek(); std::isdigit(c); c = s.peek())
-                {
-                    os << c;
-                    CONSUME();
-                }
-            };
-            auto parse_exponent = [](json_stream &s, std::stringstream &os)
+    HSJSON_INLINE json_view
+    json_view::get_attribute(std::string_view name) const
+    {
+        auto index = find(name);
+        if (index == size())
+            throw invalid_access;
+        return get_at(index);
+    }
+
+    HSJSON_INLINE json_value
+    json_view::to_value() const
+    {
+        switch (type())
+        {
+        case json_type::null:
+            return json_null{};
+        case json_type::boolean:
+            return get_as<json_boolean>();
+        case json_type::number:
+            return get_as<json_number>();
+        case json_type::string:
+            return get_as<json_string>();
+        case json_type::array:
+        {
+            json_array array{};
+            array.reserve(size());
+            for (std::size_t i = 0, n = size(); i < n; ++i)
+                array.push_back(get_at(i).to_value());
+            return array;
+        }
+        default:
+        {
+            json_object object{};
+            for (std::size_t i = 0, n = size(); i < n; ++i)
+                object.insert_attribute(json_string{key_at(i)}, get_at(i).to_value());
+            return object;
+        }
+        }
+    }
+
+    HSJSON_INLINE double
+    pipeline_stats::decompress_throughput() const noexcept
+    {
+        return decompressed_bytes / std::chrono::duration<double>(decompress_time).count();
+    }
+
+    HSJSON_INLINE double
+    pipeline_stats::parse_throughput() const noexcept
+    {
+        return decompressed_bytes / std::chrono::duration<double>(parse_time).count();
+    }
+
+    HSJSON_INLINE double
+    pipeline_stats::throughput() const noexcept
+    {
+        return decompressed_bytes / std::chrono::duration<double>(wall_time).count();
+    }
+
+    namespace detail
+    {
+        /*
+         * Fixed set of buffers passed from one producer to one consumer in
+         * order, each side blocks while the other holds every buffer
+         */
+        class buffer_ring
+        {
+        public:
+            buffer_ring(std::size_t count, std::size_t size)
+                : m_buffers(std::max<std::size_t>(count, 1), std::vector<char>(std::max<std::size_t>(size, 1))),
+                  m_sizes(m_buffers.size())
             {
-                char c = s.peek();
-                if (c != 'e' or c != 'E')
-                    return;
-                os << c;
-                CONSUME();
+            }
 
-                c = s.peek();
-                if (c == '-' or c == '+')
+            // Next buffer to fill, empty once the consumer gave up
+            std::span<char> acquire()
+            {
+                std::unique_lock lock{m_mutex};
+                if (m_head - m_tail == m_buffers.size() and not m_cancelled)
                 {
-                    os << c;
-                    CONSUME();
+                    auto start = stats_clock::now();
+                    m_changed.wait(lock, [&] { return m_head - m_tail < m_buffers.size() or m_cancelled; });
+                    producer_wait += stats_clock::now() - start;
                 }
+                if (m_cancelled)
+                    return {};
+                return m_buffers[m_head % m_buffers.size()];
+            }
 
-                c = s.peek();
-                if (not std::isdigit(c))
-                    throw parse_error;
-                os << c;
-                CONSUME();
+            void publish(std::size_t size)
+            {
+                if (not size)
+                    return;
+                std::lock_guard lock{m_mutex};
+                m_sizes[m_head++ % m_buffers.size()] = size;
+                m_changed.notify_all();
+            }
 
-                for (c = s.peek(); std::isdigit(c); c = s.peek())
+            // End of input, with the error that ended it if any
+            void close(std::exception_ptr error) noexcept
+            {
+                std::lock_guard lock{m_mutex};
+                m_closed = true;
+                m_error = error;
+                m_changed.notify_all();
+            }
+
+            // Oldest filled buffer, empty at the end of input
+            std::string_view next()
+            {
+                std::unique_lock lock{m_mutex};
+                if (m_tail == m_head and not m_closed)
                 {
-                    os << c;
-                    CONSUME();
+                    auto start = stats_clock::now();
+                    m_changed.wait(lock, [&] { return m_tail < m_head or m_closed; });
+                    consumer_wait += stats_clock::now() - start;
                 }
-            };
+                if (m_tail < m_head)
+                    return {m_buffers[m_tail % m_buffers.size()].data(), m_sizes[m_tail % m_buffers.size()]};
+                if (m_error)
+                    std::rethrow_exception(m_error);
+                return {};
+            }
+
+            void release()
+            {
+                std::lock_guard lock{m_mutex};
+                ++m_tail;
+                m_changed.notify_all();
+            }
 
-            SKIP_WHITESPACE();
-            char c;
+            void cancel() noexcept
+            {
+                std::lock_guard lock{m_mutex};
+                m_cancelled = true;
+                m_changed.notify_all();
+            }
 
-            c = s.peek();
+            // Written by each side for itself, read once both are done
+            std::chrono::nanoseconds producer_wait{};
+            std::chrono::nanoseconds consumer_wait{};
 
-            std::stringstream os{};
+        private:
+            std::vector<std::vector<char>> m_buffers;
+            std::vector<std::size_t> m_sizes;
+            std::size_t m_head = 0;
+            std::size_t m_tail = 0;
+            bool m_closed = false;
+            bool m_cancelled = false;
+            std::exception_ptr m_error{};
+            std::mutex m_mutex{};
+            std::condition_variable m_changed{};
+        };
 
-            if (c == '-')
+        /*
+         * Splits decompressed text into top-level values, or the elements of
+         * a top-level array, without parsing them
+         * Elements within one chunk are handed over in place, only the ones
+         * crossing a chunk boundary are copied together
+         */
+        class element_framer
+        {
+        public:
+            explicit element_framer(element_framing framing = element_framing::detect) noexcept
+                : m_framing{framing}
             {
-                os << c;
-                CONSUME();
             }
 
-            c = s.peek();
+            template <typename Handler>
+            void feed(std::string_view chunk, Handler const &handler)
+            {
+                std::size_t start = 0;
+                for (std::size_t i = 0; i < chunk.size(); ++i)
+                {
+                    auto c = chunk[i];
+                    if (not m_inside)
+                    {
+                        if (is_whitespace(c))
+                            continue;
+                        if (not begin(c))
+                            continue;
+                        start = i;
+                    }
+
+                    if (m_in_string)
+                    {
+                        if (m_escaped)
+                            m_escaped = false;
+                        else if (c == '\\')
+                            m_escaped = true;
+                        else if (c == '"')
+                        {
+                            m_in_string = false;
+                            if (m_depth == 0)
+                                emit(chunk.substr(start, i + 1 - start), handler);
+                        }
+                    }
+                    else if (m_scalar)
+                    {
+                        // Scalars end at the first delimiter, which belongs to the outside
+                        if (is_whitespace(c) or c == ',' or c == ']' or c == '}')
+                        {
+                            emit(chunk.substr(start, i - start), handler);
+                            --i;
+                        }
+                    }
+                    else if (c == '"')
+                        m_in_string = true;
+                    else if (c == '{' or c == '[')
+                        ++m_depth;
+                    else if (c == '}' or c == ']')
+                    {
+                        if (--m_depth == 0)
+                            emit(chunk.substr(start, i + 1 - start), handler);
+                    }
+                }
+                if (m_inside)
+                    m_element.append(chunk.substr(start));
+            }
 
-            if (c == '0')
+            template <typename Handler>
+            void finish(Handler const &handler)
             {
-                os << c;
-                CONSUME();
+                if (m_inside and m_scalar)
+                    emit({}, handler);
+                if (m_inside or m_mode == mode::array)
+                    throw parse_error;
+                if (m_mode == mode::unknown and m_framing == element_framing::array)
+                    throw parse_error;
             }
-            else if (std::isdigit(c))
+
+        private:
+            enum class mode
+            {
+                unknown,
+                array,
+                sequence,
+                finished
+            };
+
+            // Handles a byte outside of any element, true when it starts one
+            bool begin(char c)
             {
-                os << c;
-                CONSUME();
+                switch (m_mode)
+                {
+                case mode::unknown:
+                    if (c == '[' and m_framing != element_framing::sequence)
+                    {
+                        m_mode = mode::array;
+                        return false;
+                    }
+                    if (m_framing == element_framing::array)
+                        throw parse_error;
+                    m_mode = mode::sequence;
+                    break;
+                case mode::array:
+                    if (c == ',' and m_need_comma)
+                    {
+                        m_need_comma = false;
+                        return false;
+                    }
+                    if (c == ']' and (m_need_comma or m_count == 0))
+                    {
+                        m_mode = mode::finished;
+                        return false;
+                    }
+                    if (m_need_comma)
+                        throw parse_error;
+                    break;
+                case mode::sequence:
+                    break;
+                case mode::finished:
+                    throw parse_error;
+                }
+                if (c == ',' or c == ']' or c == '}')
+                    throw parse_error;
+
+                // The opening byte is looked at again as part of the element
+                m_inside = true;
+                m_scalar = c != '{' and c != '[' and c != '"';
+                m_depth = 0;
+                return true;
+            }
 
-                for (c = s.peek(); std::isdigit(c); c = s.peek())
+            template <typename Handler>
+            void emit(std::string_view tail, Handler const &handler)
+            {
+                m_inside = false;
+                m_need_comma = true;
+                ++m_count;
+                if (m_element.empty())
+                    handler(tail);
+                else
                 {
-                    os << c;
-                    CONSUME();
+                    m_element.append(tail);
+                    handler(std::string_view{m_element});
+                    m_element.clear();
                 }
             }
-            else
-                throw parse_error;
-            parse_fraction(s, os);
-            parse_exponent(s, os);
 
-            return {std::strtod(os.str().c_str(), nullptr)};
+            element_framing m_framing;
+            mode m_mode = mode::unknown;
+            bool m_inside = false;
+            bool m_scalar = false;
+            bool m_in_string = false;
+            bool m_escaped = false;
+            bool m_need_comma = false;
+            std::size_t m_depth = 0;
+            std::size_t m_count = 0;
+            json_string m_element{};
+        };
+
+        HSJSON_INLINE compression_format detect_compression(std::string_view head) noexcept
+        {
+            auto byte = [&](std::size_t i) { return static_cast<unsigned char>(head[i]); };
+            if (head.size() >= 2 and byte(0) == 0x1f and byte(1) == 0x8b)
+                return compression_format::gzip;
+            if (head.size() >= 4 and byte(0) == 0x28 and byte(1) == 0xb5 and byte(2) == 0x2f and byte(3) == 0xfd)
+                return compression_format::zstd;
+            return compression_format::plain;
         }
 
-        json_value parse_value(json_stream &s)
+        /*
+         * Producer side of parse_compressed, fills the ring until the source
+         * runs dry or the consumer cancels
+         */
+        HSJSON_INLINE void decompress(compressed_source const &source, buffer_ring &ring,
+                                      std::size_t input_size, compression_format format, pipeline_stats &stats)
         {
-            json_value value{};
-            for (char c = s.peek(); c != json_stream::traits_type::eof(); c = s.peek())
+            std::vector<char> input(std::max<std::size_t>(input_size, 16));
+            auto read = [&]() -> std::string_view
             {
-                if (std::isspace(c))
-                {
-                    CONSUME();
-                    continue;
-                }
-                else if (c == '{')
-                {
-                    auto object = parse_object(s);
-                    value = object;
-                    return value;
-                }
-                else if (c == '[')
+                auto n = source(input);
+                stats.compressed_bytes += n;
+                return {input.data(), n};
+            };
+
+            // The magic bytes may take more than one read to arrive
+            std::size_t head = 0;
+            while (head < 4)
+            {
+                auto n = source(std::span{input}.subspan(head));
+                if (n == 0)
+                    break;
+                head += n;
+            }
+            stats.compressed_bytes += head;
+            std::string_view pending{input.data(), head};
+            if (format == compression_format::detect)
+                format = detect_compression(pending);
+            if (format == compression_format::plain)
+            {
+                while (not pending.empty())
                 {
-                    auto array = parse_array(s);
-                    value = array;
-                    return value;
+                    auto out = ring.acquire();
+                    if (out.empty())
+                        return;
+                    auto n = std::min(out.size(), pending.size());
+                    std::memcpy(out.data(), pending.data(), n);
+                    pending.remove_prefix(n);
+                    stats.decompressed_bytes += n;
+                    ring.publish(n);
+                    if (pending.empty())
+                        pending = read();
                 }
-                else if (c == '"')
+                return;
+            }
+
+            if (format == compression_format::gzip or format == compression_format::zlib)
+            {
+#ifdef HSJSON_ZLIB
+                z_stream stream{};
+                // 15 + 32 reads gzip and zlib headers alike
+                if (inflateInit2(&stream, 15 + 32) != Z_OK)
+                    throw compression_error;
+                struct end_stream
                 {
-                    auto string = parse_string(s);
-                    value = string;
-                    return value;
-                }
-                else if (c == '-' or std::isdigit(c))
+                    z_stream &stream;
+                    ~end_stream()
+                    {
+                        inflateEnd(&stream);
+                    }
+                } guard{stream};
+
+                bool ended = false;
+                bool eof = false;
+                while (true)
                 {
-                    auto number = parse_number(s);
-                    value = number;
-                    return value;
+                    auto out = ring.acquire();
+                    if (out.empty())
+                        return;
+                    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+                    stream.avail_out = static_cast<uInt>(out.size());
+                    bool stalled = false;
+                    while (stream.avail_out and not stalled)
+                    {
+                        if (pending.empty() and not eof)
+                        {
+                            pending = read();
+                            eof = pending.empty();
+                            // Concatenated gzip members continue the text
+                            if (ended and not eof)
+                            {
+                                inflateReset(&stream);
+                                ended = false;
+                            }
+                        }
+                        if (ended)
+                            break;
+
+                        // Called with no input as well, to drain what zlib holds back
+                        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(pending.data()));
+                        stream.avail_in = static_cast<uInt>(pending.size());
+                        auto result = inflate(&stream, Z_NO_FLUSH);
+                        pending.remove_prefix(pending.size() - stream.avail_in);
+                        if (result == Z_STREAM_END)
+                        {
+                            ended = true;
+                            if (not pending.empty())
+                            {
+                                inflateReset(&stream);
+                                ended = false;
+                            }
+                        }
+                        else if (result == Z_BUF_ERROR)
+                            stalled = eof;
+                        else if (result != Z_OK)
+                            throw compression_error;
+                    }
+                    auto n = out.size() - stream.avail_out;
+                    stats.decompressed_bytes += n;
+                    ring.publish(n);
+                    if (ended and eof)
+                        return;
+                    // Truncated input ends without the end of stream marker
+                    if (stalled)
+                        throw compression_error;
                 }
-                else if (c == 'f' or c == 't')
+#else
+                throw compression_error;
+#endif
+            }
+
+#ifdef HSJSON_ZSTD
+            auto stream = ZSTD_createDStream();
+            if (not stream)
+                throw compression_error;
+            struct free_stream
+            {
+                ZSTD_DStream *stream;
+                ~free_stream()
                 {
-                    auto boolean = parse_boolean(s);
-                    value = boolean;
-                    return value;
+                    ZSTD_freeDStream(stream);
                 }
-                else if (c == 'n')
+            } guard{stream};
+            ZSTD_initDStream(stream);
+
+            std::size_t hint = 1;
+            bool eof = false;
+            while (true)
+            {
+                auto out = ring.acquire();
+                if (out.empty())
+                    return;
+                ZSTD_outBuffer output{out.data(), out.size(), 0};
+                bool stalled = false;
+                while (output.pos < output.size and not stalled)
                 {
-                    auto null = parse_null(s);
-                    value = null;
-                    return value;
+                    if (pending.empty() and not eof)
+                    {
+                        pending = read();
+                        eof = pending.empty();
+                    }
+                    if (eof and hint == 0)
+                        break;
+
+                    // Called with no input as well, to drain what zstd holds back
+                    ZSTD_inBuffer in{pending.data(), pending.size(), 0};
+                    auto before = output.pos;
+                    hint = ZSTD_decompressStream(stream, &output, &in);
+                    if (ZSTD_isError(hint))
+                        throw compression_error;
+                    pending.remove_prefix(in.pos);
+                    stalled = eof and output.pos == before;
                 }
-                else
-                    throw parse_error;
+                stats.decompressed_bytes += output.pos;
+                ring.publish(output.pos);
+                // A non-zero hint means the last frame is incomplete
+                if (eof and hint == 0)
+                    return;
+                if (stalled)
+                    throw compression_error;
             }
-            throw parse_error;
+#else
+            throw compression_error;
+#endif
         }
+    }
+
+    HSJSON_INLINE void
+    parse_compressed(compressed_source const &source, element_handler const &handler,
+                     pipeline_options const &options)
+    {
+        auto start = detail::stats_clock::now();
+        pipeline_stats producer{};
+        detail::buffer_ring ring{options.buffer_count, options.buffer_size};
+        std::thread worker{[&]
+                           {
+                               try
+                               {
+                                   detail::decompress(source, ring, options.buffer_size, options.format, producer);
+                                   ring.close({});
+                               }
+                               catch (...)
+                               {
+                                   ring.close(std::current_exception());
+                               }
+                               producer.decompress_time = detail::stats_clock::now() - start;
+                           }};
 
-        json_boolean parse_boolean(json_stream &s)
+        // Stop the producer on any early exit, it may be blocked on a full ring
+        struct join_worker
         {
-            char c;
-            std::string string;
-            for (c = s.peek(); std::isalpha(c); c = s.peek())
+            detail::buffer_ring &ring;
+            std::thread &worker;
+            ~join_worker()
             {
-                string += c;
-                CONSUME();
+                if (worker.joinable())
+                {
+                    ring.cancel();
+                    worker.join();
+                }
             }
-            if (string == "false")
-                return {false};
-            else if (string == "true")
-                return {true};
-            else
-                throw parse_error;
-        }
+        } guard{ring, worker};
 
-        json_null parse_null(json_stream &s)
+        parser reusable{options.parse};
+        detail::element_framer framer{options.framing};
+        std::size_t elements = 0;
+        auto on_element = [&](std::string_view text)
         {
-            char c;
-            std::string string;
-            for (c = s.peek(); std::isalpha(c); c = s.peek())
-            {
-                string += c;
-                CONSUME();
-            }
-            if (string == "null")
-                return {};
-            else
-                throw parse_error;
+            ++elements;
+            handler(reusable.parse(text));
+        };
+        for (auto chunk = ring.next(); not chunk.empty(); chunk = ring.next())
+        {
+            framer.feed(chunk, on_element);
+            ring.release();
         }
+        framer.finish(on_element);
+        auto parsed = detail::stats_clock::now();
+        worker.join();
 
-#undef SKIP_WHITESPACE
-#undef CONSUME
+        if (options.stats)
+        {
+            auto &stats = *options.stats;
+            stats = producer;
+            stats.element_count = elements;
+            stats.decompress_time -= ring.producer_wait;
+            stats.parse_time = parsed - start - ring.consumer_wait;
+            stats.wall_time = detail::stats_clock::now() - start;
+        }
     }
 
-    json_value parse(json_string const &s)
+    HSJSON_INLINE void
+    parse_compressed(int fd, element_handler const &handler, pipeline_options const &options)
     {
-        json_stream stream(s);
-        return parse_value(stream);
+        auto source = [fd](std::span<char> buffer) -> std::size_t
+        {
+            while (true)
+            {
+                auto n = ::read(fd, buffer.data(), buffer.size());
+                if (n >= 0)
+                    return n;
+                if (errno != EINTR)
+                    throw compression_error;
+            }
+        };
+        parse_compressed(source, handler, options);
     }
 
 }
@@ -3,9 +3,31 @@
 
 #include <type_traits>
 #include <map>
+#include <unordered_map>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <string>
 #include <any>
+#include <atomic>
+#include <span>
+#include <string_view>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <compare>
+#include <iterator>
+
+/*
+ * Defining HSJSON_HEADER_ONLY pulls the definitions of hsjson.cc into every
+ * includer as inline functions, so accessors can be inlined at call sites
+ */
+#ifdef HSJSON_HEADER_ONLY
+#define HSJSON_INLINE inline
+#else
+#define HSJSON_INLINE
+#endif
 
 namespace hs
 {
@@ -14,6 +36,20 @@ namespace hs
         static constexpr int parse_error = 1;
         static constexpr int invalid_access = 2;
         static constexpr int conversion_error = 3;
+        static constexpr int limit_error = 4;
+        static constexpr int schema_error = 5;
+        static constexpr int write_error = 6;
+        static constexpr int compression_error = 7;
+
+        enum class json_type
+        {
+            null,
+            boolean,
+            number,
+            string,
+            object,
+            array
+        };
 
         class json_number
         {
@@ -47,6 +83,46 @@ namespace hs
 
         using json_string = std::string;
 
+        /*
+         * String living in a buffer owned by the caller, produced by in-situ
+         * parsing. Points at NUL terminated text and keeps its length, so
+         * reading it never scans for the terminator
+         */
+        class json_string_ref
+        {
+        public:
+            explicit json_string_ref(char const *data) noexcept;
+            json_string_ref(char const *data, std::size_t size) noexcept;
+
+            std::string_view view() const noexcept;
+            char const *c_str() const noexcept;
+
+        private:
+            char const *m_data;
+            std::size_t m_size;
+        };
+
+        /*
+         * Heap bytes owned by a tree, broken down by category
+         * Sizes follow the node layout of the common standard libraries and
+         * do not include allocator bookkeeping
+         */
+        struct json_memory_usage
+        {
+            std::size_t value_bytes = 0;  // payloads std::any keeps on the heap
+            std::size_t object_bytes = 0; // map nodes of objects
+            std::size_t array_bytes = 0;  // element buffers of arrays
+            std::size_t string_bytes = 0; // buffers of string values
+            std::size_t key_bytes = 0;    // buffers of object keys
+            std::size_t allocations = 0;
+
+            std::size_t total() const noexcept;
+            json_memory_usage &operator+=(json_memory_usage const &) noexcept;
+        };
+
+
+        class json_pool;
+        struct json_shared_node;
 
         struct json_value
         {
@@ -69,15 +145,61 @@ namespace hs
 
             /*
              * Get underlying value
+             * Strings held as json_string_ref convert to json_string, and
+             * std::string_view reads either kind without copying
              * Will throw <conversion_error> if type not match
              */
             template<typename T>
             T get_as() const;
 
+            /*
+             * as<json_string>() & turns a json_string_ref into an owned
+             * string first, the const overload throws for it instead
+             */
             template<typename T>
             T& as() &;
 
+            template<typename T>
+            T const& as() const &;
+
+            /*
+             * Kind of the held value, an empty value reads as null
+             */
+            json_type type() const noexcept;
+
+            /*
+             * Heap footprint of this value and everything below it
+             */
+            json_memory_usage memory_usage() const noexcept;
+
+            /*
+             * Release spare capacity of every container and string below
+             */
+            void shrink_to_fit();
+
+            /*
+             * Structural equality, object members compare regardless of
+             * insertion order and numbers by value
+             */
+            bool operator==(json_value const &other) const;
+
+            /*
+             * Structural hash, equal values hash equally and object member
+             * order does not contribute
+             * Cached for subtrees shared through a json_pool, computed over the
+             * whole subtree otherwise
+             */
+            std::size_t hash() const noexcept;
+
         private:
+            friend class json_pool;
+
+            // Contents, looking through a json_pool subtree
+            std::any const &held() const noexcept;
+
+            // Copy shared contents in before handing out a mutable reference
+            void unshare();
+
             std::any m_value;
         };
 
@@ -86,6 +208,11 @@ namespace hs
         class json_object
         {
         public:
+            using container_type = std::map<json_string, json_value>;
+            using value_type = container_type::value_type;
+            using iterator = container_type::iterator;
+            using const_iterator = container_type::const_iterator;
+
             json_object() = default;
 
             /*
@@ -126,17 +253,77 @@ namespace hs
              * Will add requested attribute if it does not exist
              */
             json_value &operator[](json_string const &name) &;
+            json_value &operator[](json_string &&name) &;
 
 
             int size() const noexcept;
 
+            /*
+             * Iterate attributes in key order without copying,
+             * elements are key/value pairs usable with structured bindings
+             */
+            iterator begin() noexcept;
+            iterator end() noexcept;
+            const_iterator begin() const noexcept;
+            const_iterator end() const noexcept;
+            const_iterator cbegin() const noexcept;
+            const_iterator cend() const noexcept;
+
+            json_memory_usage memory_usage() const noexcept;
+            void shrink_to_fit();
+
+            bool operator==(json_object const &other) const;
+
+            /*
+             * Input text of the object when parsed with <keep_source>, empty
+             * otherwise. The tree shares ownership of the text, so it stays
+             * valid after the input is gone. Mutable access marks the object
+             * modified, json_writer copies the text of unmodified objects as is
+             */
+            std::string_view source() const noexcept;
+            bool modified() const noexcept;
+
         private:
-            std::map<json_string, json_value> m_attributes;
+            friend class parser;
+            friend class json_writer;
+
+            container_type m_attributes;
+            std::shared_ptr<char const> m_source{};
+            std::size_t m_source_size = 0;
+            bool m_modified = false;
         };
 
+        /*
+         * Arrays of only numbers or only booleans can be packed: elements are
+         * kept unboxed in one contiguous buffer, readable through as_span().
+         * Arrays are packed by pack(), the vector constructors or a parse
+         * with <pack_arrays>. The element interface works on either form:
+         * const iteration of a packed array boxes all elements once into a
+         * copy kept until the array changes, mutable access other than
+         * push_back() of the packed type unpacks the array first
+         */
         class json_array
         {
         public:
+            using container_type = std::vector<json_value>;
+            using value_type = json_value;
+            using iterator = container_type::iterator;
+
+            using const_iterator = container_type::const_iterator;
+
+            json_array() noexcept;
+            json_array(json_array const &other);
+            json_array(json_array &&other) noexcept;
+            json_array &operator=(json_array const &other);
+            json_array &operator=(json_array &&other) noexcept;
+            ~json_array();
+
+            /*
+             * Packed arrays taking over <numbers> or <booleans>
+             */
+            explicit json_array(std::vector<double> numbers);
+            explicit json_array(std::vector<json_boolean> booleans);
+
             size_t size() const noexcept;
             bool empty() const noexcept;
 
@@ -154,15 +341,913 @@ namespace hs
             void set(size_t index, json_value&&);
 
             json_value& operator[](size_t index);
+
+            void reserve(size_t capacity);
+
+            /*
+             * Iterate elements in order without copying
+             * Const iteration of a packed array allocates the boxed copy on
+             * first use, as_span() reads packed elements in place
+             */
+            iterator begin();
+            iterator end();
+            const_iterator begin() const;
+            const_iterator end() const;
+            const_iterator cbegin() const;
+            const_iterator cend() const;
+
+            /*
+             * Pack the elements if they are all numbers or all booleans,
+             * returns whether the array is packed afterwards
+             */
+            bool pack();
+            bool packed() const noexcept;
+
+            /*
+             * Elements of an array packed as double or json_boolean, empty
+             * arrays give an empty span
+             * Will throw <conversion_error> if type not match
+             */
+            template<typename T>
+            std::span<T const> as_span() const;
+
+            json_memory_usage memory_usage() const noexcept;
+            void shrink_to_fit();
+
+            bool operator==(json_array const &other) const;
+
+            /*
+             * Input text of the array when parsed with <keep_source>, as for
+             * json_object. Arrays without it always read as unmodified
+             */
+            std::string_view source() const noexcept;
+            bool modified() const noexcept;
+
         private:
-            std::vector<json_value> m_values;
+            friend class parser;
+            friend class json_writer;
+
+            // Packed elements, their boxed copy and the kept input text
+            struct extras;
+
+            // Box the elements of a packed array
+            void unpack();
+            json_value boxed(size_t index) const;
+
+            // Elements for const iteration, boxed on first use when packed
+            container_type const &values() const;
+            void drop_boxed() noexcept;
+
+            extras &extra();
+            void mark_modified() noexcept;
+
+            container_type m_values;
+
+            // Allocated only for packed arrays and those with a source,
+            // <m_values> is empty while it holds packed elements
+            std::unique_ptr<extras> m_extras;
+        };
+
+        /*
+         * Statistics collected over a single parse
+         * Allocations count the heap blocks requested while building the tree,
+         * phase times are wall-clock and tokenize_time covers everything that is
+         * not number conversion or tree building
+         */
+        struct parse_stats
+        {
+            std::size_t bytes_consumed = 0;
+
+            std::size_t object_count = 0;
+            std::size_t array_count = 0;
+            std::size_t string_count = 0;
+            std::size_t number_count = 0;
+            std::size_t boolean_count = 0;
+            std::size_t null_count = 0;
+
+            std::size_t max_depth = 0;
+            std::size_t string_bytes = 0;
+
+            std::size_t allocation_count = 0;
+            std::size_t allocation_bytes = 0;
+
+            std::chrono::nanoseconds tokenize_time{};
+            std::chrono::nanoseconds number_time{};
+            std::chrono::nanoseconds build_time{};
+        };
+
+        /*
+         * Receives statistics of every successful parse once installed
+         * with set_parse_observer
+         */
+        class parse_observer
+        {
+        public:
+            virtual ~parse_observer() = default;
+            virtual void on_parse(parse_stats const &stats) = 0;
+        };
+
+        /*
+         * Install a process wide observer, pass nullptr to disable collection
+         * The observer must outlive every parse that may still report to it
+         * Has no effect when built with HSJSON_NO_STATS
+         */
+        void set_parse_observer(parse_observer *observer) noexcept;
+
+        class json_schema;
+        class json_projection;
+
+        /*
+         * First schema violation found in a document
+         * <path> is a JSON pointer to the offending value and <offset> the
+         * byte offset where it starts in the input
+         */
+        struct schema_violation
+        {
+            bool valid = true;
+            std::string path{};
+            std::size_t offset = 0;
+            std::string message{};
+        };
+
+        /*
+         * Limits applied while parsing
+         * Will throw <limit_error> when the input exceeds any of them, and
+         * on numbers too large for a double, which could not be written back
+         */
+        struct parse_options
+        {
+            std::size_t max_depth = 1024;
+            std::size_t max_document_size = std::numeric_limits<std::size_t>::max();
+            std::size_t max_string_length = std::numeric_limits<std::size_t>::max();
+
+            // Filled when set, installed observer is notified as well
+            parse_stats *stats = nullptr;
+
+            // Checked while parsing, parse throws <schema_error> at the first
+            // violation and describes it in <violation> when set
+            json_schema const *schema = nullptr;
+            schema_violation *violation = nullptr;
+
+            // Only members on one of its paths are materialized, the rest is
+            // skipped by the tokenizer and not checked against <schema>
+            json_projection const *projection = nullptr;
+
+            // Every finished subtree is interned, repeated ones share a node
+            json_pool *pool = nullptr;
+
+            // Containers remember their span of a copy of the input, shared by
+            // the tree, and json_writer copies unmodified ones verbatim. Those
+            // holding a repeated key keep none. Ignored by parse_in_situ and
+            // with <projection> or <pool>
+            bool keep_source = false;
+
+            // Arrays of only numbers or only booleans are built packed
+            bool pack_arrays = false;
         };
 
+        /*
+         * Parse a complete document, only whitespace may follow the value
+         * Will throw <parse_error> on malformed input
+         */
         json_value parse(json_string const& s);
+
+        /*
+         * Parse and fill <stats>, installed observer is notified as well
+         */
+        json_value parse(json_string const& s, parse_stats &stats);
+
+        json_value parse(json_string const& s, parse_options const& options);
+
+        /*
+         * Parse inside <buffer>, decoding strings in place
+         * String values become json_string_ref pointing into the buffer, which
+         * is modified by the call and must outlive the returned tree.
+         * Keys are still copied since objects own them, and strings that
+         * decode to an embedded NUL fall back to json_string
+         */
+        json_value parse_in_situ(std::span<char> buffer);
+        json_value parse_in_situ(std::span<char> buffer, parse_options const& options);
+
+        struct validation_result
+        {
+            bool valid = true;
+
+            // <parse_error> or <limit_error> when not valid
+            int error = 0;
+
+            // Byte at which the document stopped being acceptable
+            std::size_t offset = 0;
+        };
+
+        /*
+         * Check that <text> is a document parse() would accept, without
+         * building a tree: grammar, escapes, UTF-8, number syntax and range.
+         * Honours <max_depth>, <max_document_size> and <max_string_length>,
+         * the remaining options do not apply. Allocates only to track nesting
+         * deeper than 4096 levels. Never throws
+         */
+        validation_result validate(std::string_view text, parse_options const &options = {}) noexcept;
+
+        /*
+         * Text transforms working on raw text, no tree is built and string
+         * contents are copied untouched. <text> is expected to be valid JSON,
+         * validate() it first when it is not trusted. Both throw <parse_error>
+         * on an unterminated string, prettify() also on an unbalanced bracket;
+         * minify() does not track brackets and copies them as they are.
+         * Overloads taking <out> return the bytes written and throw
+         * <write_error> when it is too small, they allocate nothing
+         */
+
+        /*
+         * Drop all whitespace between tokens
+         * <out> as large as <text> always suffices and may be <text> itself
+         */
+        std::size_t minify(std::string_view text, std::span<char> out);
+        json_string minify(std::string_view text);
+
+        /*
+         * One value or member per line, nested <indent> spaces deeper than
+         * its container, a space after colons and empty containers kept on
+         * one line. prettified_size() is the exact size of the output
+         */
+        std::size_t prettify(std::string_view text, std::span<char> out, std::size_t indent = 2);
+        std::size_t prettified_size(std::string_view text, std::size_t indent = 2);
+        json_string prettify(std::string_view text, std::size_t indent = 2);
+
+        /*
+         * Pull reader walking a document in order without building a tree
+         *
+         * The cursor sits on one value at a time: peek_type() tells what it
+         * is, read_*(), enter_*() or skip_value() consume it. Inside a
+         * container next() moves to the following element, reading the key
+         * of object members, and returns false once the container closes.
+         * A value left unread is skipped by next().
+         *
+         * Strings are views into the input unless they contain escapes, in
+         * which case they are decoded into a buffer owned by the reader.
+         * Views stay valid until the next call that reads a string.
+         * Will throw <parse_error>, <limit_error> on malformed input and
+         * <conversion_error> when reading a value as the wrong type
+         */
+        class json_reader
+        {
+        public:
+            json_reader() = default;
+            explicit json_reader(std::string_view s, parse_options const &options = {});
+
+            /*
+             * Restart on a new document, keeping options and buffers
+             */
+            void reset(std::string_view s);
+            parse_options &options() noexcept;
+
+            json_type peek_type();
+            bool next();
+            std::string_view key() const noexcept;
+
+            std::string_view read_string_view();
+            double read_number();
+            bool read_boolean();
+            void read_null();
+            void skip_value();
+
+            void enter_object();
+            void enter_array();
+
+            std::size_t depth() const noexcept;
+            std::size_t offset() const noexcept;
+
+        private:
+            friend class parser;
+            friend class json_schema;
+
+            enum class token
+            {
+                begin_object,
+                end_object,
+                begin_array,
+                end_array,
+                key,
+                string,
+                number,
+                boolean,
+                null,
+                end
+            };
+
+            enum class state
+            {
+                value,
+                first_value,
+                key,
+                first_key,
+                after_value,
+                done
+            };
+
+            token next_token();
+            token read_value();
+            std::string_view read_string_in_place();
+            token open(char bracket);
+            token close(char bracket);
+            void read_key();
+            std::string_view read_string(json_string &buffer);
+            void read_literal(std::string_view literal);
+            void read_number_token();
+            void skip_whitespace() noexcept;
+            int peek() const noexcept;
+            void expect_value();
+
+            char const *m_begin = nullptr;
+            char const *m_cur = nullptr;
+            char const *m_end = nullptr;
+            char const *m_token = nullptr;
+            parse_options m_options{};
+            parse_stats *m_stats = nullptr;
+            state m_state = state::value;
+
+            // Kinds of the open containers, short stacks stay in the SSO buffer
+            json_string m_stack{};
+            json_string m_buffer{};
+            json_string m_key_buffer{};
+            std::string_view m_string{};
+            std::string_view m_key{};
+            double m_number = 0;
+            bool m_boolean = false;
+
+            // Set by parser for in-situ parses, m_escaped tells whether the
+            // last string needed decoding
+            bool m_in_situ = false;
+            bool m_escaped = false;
+        };
+
+        /*
+         * JSON Schema subset compiled once and checked in a single pass,
+         * either fused into parse() through parse_options or over raw text
+         *
+         * Supported keywords: type (including integer), enum with scalar
+         * members, minimum, maximum, exclusiveMinimum, exclusiveMaximum,
+         * minLength, maxLength, properties, required, additionalProperties,
+         * minProperties, maxProperties, items, minItems, maxItems.
+         * Other annotations are ignored
+         */
+        class json_schema
+        {
+        public:
+            /*
+             * Will throw <schema_error> if the schema is malformed or relies
+             * on keywords outside the subset ($ref, allOf, anyOf, ...)
+             */
+            static json_schema compile(json_value const &schema);
+
+            /*
+             * Check a document without building it
+             * Will throw <parse_error>, <limit_error> on malformed input
+             */
+            schema_violation validate(std::string_view text, parse_options const &options = {}) const;
+
+        private:
+            friend class parser;
+
+            static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+            static constexpr unsigned integer_type = 1u << 6;
+
+            struct node
+            {
+                unsigned types = ~0u;
+                double minimum = -std::numeric_limits<double>::infinity();
+                double maximum = std::numeric_limits<double>::infinity();
+                double exclusive_minimum = -std::numeric_limits<double>::infinity();
+                double exclusive_maximum = std::numeric_limits<double>::infinity();
+                std::size_t min_length = 0;
+                std::size_t max_length = npos;
+                std::size_t min_items = 0;
+                std::size_t max_items = npos;
+                std::size_t min_properties = 0;
+                std::size_t max_properties = npos;
+
+                // Sorted by key, second is the index of the member schema
+                std::vector<std::pair<json_string, std::size_t>> properties{};
+                std::vector<json_string> required{};
+                bool additional_properties = true;
+                std::size_t additional = npos;
+                std::size_t items = npos;
+                std::vector<json_value> enumeration{};
+            };
+
+            class validator;
+
+            std::size_t compile_node(json_value const &schema);
+            static void feed(validator &v, json_reader const &reader, json_reader::token tok);
+
+            std::vector<node> m_nodes{};
+        };
+
+        /*
+         * Set of paths to keep when parsing, written as JSON pointers such as
+         * "/age" or "/friends/name"
+         * Arrays are transparent: a path applies to every element of the
+         * arrays it crosses, so "/friends/name" keeps the name of each friend.
+         * Scalars a path continues past are dropped, as they hold nothing it
+         * selects
+         */
+        class json_projection
+        {
+        public:
+            /*
+             * Will throw <parse_error> for paths that are not JSON pointers
+             */
+            static json_projection compile(std::vector<std::string_view> const &paths);
+
+        private:
+            friend class parser;
+
+            // Results of a lookup besides the index of a nested node
+            static constexpr std::size_t keep_all = std::numeric_limits<std::size_t>::max();
+            static constexpr std::size_t skip = keep_all - 1;
+
+            struct node
+            {
+                // Sorted by key once compiled
+                std::vector<std::pair<json_string, std::size_t>> children{};
+            };
+
+            std::size_t find(std::size_t node, std::string_view key) const noexcept;
+
+            std::vector<node> m_nodes{};
+        };
+
+        /*
+         * Hash-consing table, identical subtrees interned through one pool
+         * share a single immutable node, within a document and across them
+         * Shared nodes are reference counted and outlive the pool; as<T>() &
+         * copies one level out of a node before it can be modified.
+         * Not thread safe, the documents it produces can be read concurrently
+         */
+        class json_pool
+        {
+        public:
+            json_pool() = default;
+            json_pool(json_pool const &) = delete;
+            json_pool &operator=(json_pool const &) = delete;
+            json_pool(json_pool &&other) noexcept;
+            json_pool &operator=(json_pool &&other) noexcept;
+            ~json_pool();
+
+            /*
+             * Share every container and heap-allocated string of <value>
+             * with an identical subtree interned before, or intern it
+             */
+            json_value intern(json_value value);
+
+            // Distinct subtrees held
+            std::size_t size() const noexcept;
+
+            /*
+             * Heap footprint of the shared nodes, documents only account for
+             * their handles to them
+             */
+            json_memory_usage memory_usage() const noexcept;
+
+            /*
+             * Forget every node, documents keep the ones they still use
+             */
+            void clear() noexcept;
+
+        private:
+            std::unordered_multimap<std::size_t, json_shared_node *> m_nodes{};
+        };
+
+        struct json_reclaimer_state;
+
+        /*
+         * Destroys trees away from latency sensitive code
+         * dispose() takes a tree and returns without freeing anything. In
+         * background mode a worker thread destroys queued trees in batches,
+         * otherwise they wait until collect() destroys them on the calling
+         * thread. Trees still queued are destroyed with the reclaimer.
+         * Thread safe
+         */
+        class json_reclaimer
+        {
+        public:
+            explicit json_reclaimer(bool background = true);
+            json_reclaimer(json_reclaimer const &) = delete;
+            json_reclaimer &operator=(json_reclaimer const &) = delete;
+            ~json_reclaimer();
+
+            void dispose(json_value &&value);
+
+            /*
+             * Destroy every queued tree now, returns how many there were
+             */
+            std::size_t collect();
+
+            /*
+             * Wait until the trees disposed so far are destroyed, collects
+             * instead when there is no worker
+             */
+            void drain();
+
+            // Trees disposed but not destroyed yet
+            std::size_t pending() const;
+
+        private:
+            std::unique_ptr<json_reclaimer_state> m_state;
+        };
+
+        /*
+         * Parser that keeps its scratch buffers between calls
+         * Once warmed up, the only allocations left are the ones owned by the
+         * returned tree. Not thread safe, keep one per thread
+         */
+        class parser
+        {
+        public:
+            parser() = default;
+            explicit parser(parse_options const &options);
+
+            json_value parse(std::string_view s);
+            json_value parse_in_situ(std::span<char> buffer);
+
+            parse_options &options() noexcept;
+
+            /*
+             * Give back the memory retained by the scratch buffers
+             */
+            void shrink_to_fit();
+
+        private:
+            /*
+             * Container whose closing bracket is pending
+             * Array elements wait on the shared value stack from <first> on
+             */
+            struct frame
+            {
+                bool is_object = false;
+                json_object object{};
+                std::size_t first = 0;
+                json_string key{};
+                std::size_t projection = 0;
+                std::size_t next_projection = 0;
+                char const *source = nullptr;
+                // A key repeats within, so the text no longer spells the tree
+                bool repeated_key = false;
+            };
+
+            json_value build(std::string_view s, bool in_situ);
+
+            parse_options m_options{};
+            json_reader m_reader{};
+            std::vector<frame> m_frames{};
+            std::vector<json_value> m_values{};
+        };
+
+        /*
+         * One member of a record array laid out contiguously, row by row
+         * Rows where the member is null or missing have their bit set in
+         * <nulls> and a zero, false or empty placeholder in the data
+         */
+        struct json_column
+        {
+            json_string name{};
+
+            // Null while no row had a value
+            json_type type = json_type::null;
+
+            std::vector<double> numbers{};
+            std::vector<std::uint64_t> booleans{}; // bit i is row i
+            json_string characters{};              // every string back to back
+            std::vector<std::size_t> offsets{};    // row i is [offsets[i], offsets[i + 1])
+            std::vector<std::uint64_t> nulls{};
+
+            bool is_null(std::size_t row) const noexcept;
+            bool boolean(std::size_t row) const noexcept;
+            std::string_view string(std::size_t row) const noexcept;
+        };
+
+        /*
+         * Expected member of every record, a null type is taken from the data
+         */
+        struct json_column_spec
+        {
+            json_string name{};
+            json_type type = json_type::null;
+        };
+
+        struct json_columns
+        {
+            std::size_t rows = 0;
+            std::vector<json_column> columns{};
+
+            /*
+             * Will throw <invalid_access> if there is no such column
+             */
+            json_column const &operator[](std::string_view name) const;
+        };
+
+        /*
+         * Struct-of-arrays copy of an array of objects
+         * Without a <shape>, columns are the members in order of the first
+         * record holding them, those new in one record in key order, and
+         * are typed by their first non-null value. Object and array
+         * members are not columnar, they are left out of inferred shapes.
+         * Members outside a supplied shape are ignored.
+         * Rows are split over <threads> workers, 0 uses every core; small
+         * inputs stay on the calling thread
+         * Will throw <conversion_error> when a row is not an object or a
+         * value does not match the type of its column
+         */
+        json_columns to_columns(json_array const &records,
+                                std::vector<json_column_spec> const &shape = {},
+                                std::size_t threads = 1);
+
+        /*
+         * Same, reading the records straight from text without building them
+         * Will throw <parse_error>, <limit_error> on malformed input
+         */
+        json_columns to_columns(std::string_view text,
+                                std::vector<json_column_spec> const &shape = {},
+                                std::size_t threads = 1,
+                                parse_options const &options = {});
+
+        /*
+         * Generates JSON text without building a tree
+         * Output collects in a fixed buffer that is handed to the sink each
+         * time it fills up and on flush(), so memory does not grow with the
+         * document. Keys and values are written in call order, commas and
+         * string escapes are added.
+         * Debug builds check the calls form one well-formed value
+         * Will throw <write_error> when a check fails, for numbers that are not
+         * finite, and when the sink of fd_sink() cannot write
+         */
+        class json_writer
+        {
+        public:
+            using sink = std::function<void(std::string_view)>;
+
+            /*
+             * Writes through <buffer>, which is used as is and must not be
+             * empty; the writer itself allocates nothing
+             */
+            json_writer(sink output, std::span<char> buffer);
+            explicit json_writer(sink output, std::size_t chunk_size = 4096);
+            json_writer(json_writer const &) = delete;
+            json_writer &operator=(json_writer const &) = delete;
+
+            /*
+             * Flushes what is left, call flush() first to see sink errors
+             */
+            ~json_writer();
+
+            /*
+             * Sink writing to a file descriptor, retrying partial writes
+             */
+            static sink fd_sink(int fd);
+
+            void begin_object();
+            void end_object();
+            void begin_array();
+            void end_array();
+            void key(std::string_view name);
+
+            void value(std::string_view string);
+            void value(json_string const &string);
+            void value(char const *string);
+            void value(double number);
+            void value(int number);
+            void value(long number);
+            void value(long long number);
+            void value(unsigned number);
+            void value(unsigned long number);
+            void value(unsigned long long number);
+            void value(bool boolean);
+            void value(std::nullptr_t);
+            void value(json_value const &tree);
+
+            void flush();
+
+            // Bytes produced so far, flushed or not
+            std::size_t bytes_written() const noexcept;
+
+        private:
+            void before_value();
+            void after_value() noexcept;
+            void put(char c);
+            void put(std::string_view data);
+            void write_string(std::string_view string);
+            template <typename T>
+            void write_number(T number);
+
+            // Containers parsed with <keep_source>: the input text with only
+            // the modified values in it encoded again
+            void write_source(json_object const &object);
+            void write_source(json_array const &array);
+            void write_member(json_value const &member, std::string_view text);
+
+            sink m_sink;
+            std::unique_ptr<char[]> m_owned{};
+            std::span<char> m_buffer{};
+            std::size_t m_used = 0;
+            std::size_t m_flushed = 0;
+
+            // Open containers, '{' or '['
+            json_string m_stack{};
+            bool m_comma = false;
+            bool m_key_pending = false;
+            bool m_done = false;
+        };
+
+        /*
+         * Compact JSON text of a tree
+         */
+        json_string serialize(json_value const &value);
+
+        /*
+         * Same text, written on up to <threads> threads, 0 uses every core
+         * Containers with many elements are split into runs of elements that
+         * are written into separate buffers and joined in order as they are
+         * finished, only a few runs per thread are held at once. Trees with
+         * no such container stay on the calling thread
+         */
+        json_string serialize(json_value const &value, std::size_t threads);
+
+        /*
+         * Same, finished runs going to <fd> with vectored writes and freed
+         * Will throw <write_error> when the file cannot be written
+         */
+        void serialize_to_fd(int fd, json_value const &value, std::size_t threads = 0);
+
+        /*
+         * Relocatable binary form of a document, built once and read in place
+         * Parts refer to each other by offset from the start of the tape,
+         * never by address, so the bytes can be written to a file, mapped or
+         * placed in shared memory and read through json_view with no
+         * deserialization step. Object members are stored sorted by key and
+         * objects of at least 16 members carry a hash index of their keys.
+         * Repeated strings are stored once. Numbers and lengths use the
+         * native byte order, which is checked when a tape is opened
+         */
+        std::vector<char> make_tape(json_value const &value);
+
+        /*
+         * Read-only value inside a tape, two words that are cheap to copy
+         * The tape must outlive every view into it. Its contents are trusted,
+         * only the header is checked. No accessor allocates except to_value()
+         * Will throw <conversion_error> if type not match and
+         * <invalid_access> for missing members or out of range indexes
+         */
+        class json_view
+        {
+        public:
+            /*
+             * Root value of <tape>, which may start at any address
+             * Will throw <parse_error> when the bytes are not a tape of this
+             * version and byte order
+             */
+            explicit json_view(std::span<char const> tape);
+
+            json_type type() const noexcept;
+
+            /*
+             * Same conversions as json_value::get_as for json_null,
+             * json_boolean, json_number, json_string and std::string_view,
+             * views point into the tape
+             */
+            template<typename T>
+            T get_as() const;
+
+            /*
+             * Elements of an array or members of an object
+             */
+            std::size_t size() const;
+
+            json_view get_at(std::size_t index) const;
+
+            /*
+             * Members in key order, get_at() gives the value of the same member
+             */
+            std::string_view key_at(std::size_t index) const;
+
+            bool has_attribute(std::string_view name) const;
+            json_view get_attribute(std::string_view name) const;
+
+            /*
+             * Copy of the subtree as an owned tree
+             */
+            json_value to_value() const;
+
+        private:
+            json_view(char const *tape, std::uint64_t ref) noexcept;
+
+            // Index of the member named <name>, size() when there is none
+            std::size_t find(std::string_view name) const;
+            std::uint64_t container() const;
+
+            char const *m_tape = nullptr;
+
+            // Offset of the payload, tagged with the type in the low bits
+            std::uint64_t m_ref = 0;
+        };
+
+        /*
+         * Timings of one parse_compressed call, stage times leave out the
+         * time a stage spent waiting on the other
+         */
+        struct pipeline_stats
+        {
+            std::size_t compressed_bytes = 0;
+            std::size_t decompressed_bytes = 0;
+            std::size_t element_count = 0;
+
+            std::chrono::nanoseconds decompress_time{}; // reading and decompressing
+            std::chrono::nanoseconds parse_time{};      // framing, parsing and the handler
+            std::chrono::nanoseconds wall_time{};
+
+            // Decompressed bytes per second, of each stage alone and overall
+            double decompress_throughput() const noexcept;
+            double parse_throughput() const noexcept;
+            double throughput() const noexcept;
+        };
+
+        /*
+         * Input format of parse_compressed. <detect> tells gzip and zstd from
+         * plain text by their magic bytes; raw zlib has no magic that plain
+         * JSON cannot start with ("80" is a valid zlib header), it has to be
+         * named
+         */
+        enum class compression_format
+        {
+            detect,
+            plain,
+            gzip,
+            zlib,
+            zstd
+        };
+
+        /*
+         * How parse_compressed splits the text into elements. <detect> reads
+         * a leading '[' as one top-level array and anything else as a
+         * sequence of values, so JSON lines whose first record is an array
+         * have to be named a <sequence>
+         */
+        enum class element_framing
+        {
+            detect,
+            array,
+            sequence
+        };
+
+        struct pipeline_options
+        {
+            // Ring the decompressing thread fills ahead of the parser
+            std::size_t buffer_size = 64 * 1024;
+            std::size_t buffer_count = 4;
+            compression_format format = compression_format::detect;
+            element_framing framing = element_framing::detect;
+
+            // Applies to each element
+            parse_options parse{};
+            pipeline_stats *stats = nullptr;
+        };
+
+        // Fills the span with compressed bytes, returns 0 at the end
+        using compressed_source = std::function<std::size_t(std::span<char>)>;
+        using element_handler = std::function<void(json_value &&)>;
+
+        /*
+         * Decompress on a second thread while parsing on the calling one
+         * The input is gzip, zlib, zstd (when built with it) or plain text,
+         * as given by <options.format>. It holds one top-level array, whose
+         * elements are handed over one at a time, or a sequence of values
+         * such as JSON lines, as given by <options.framing>. Only the ring
+         * and the element being read are kept in memory.
+         * Will throw <compression_error> on corrupt or unsupported input,
+         * <parse_error>, <limit_error> on malformed JSON, and whatever the
+         * source or the handler throw
+         */
+        void parse_compressed(compressed_source const &source, element_handler const &handler,
+                              pipeline_options const &options = {});
+        void parse_compressed(int fd, element_handler const &handler,
+                              pipeline_options const &options = {});
     }
 
 
 }
 
+template <>
+struct std::hash<hs::json::json_value>
+{
+    std::size_t operator()(hs::json::json_value const &value) const noexcept
+    {
+        return value.hash();
+    }
+};
+
+
+#ifdef HSJSON_HEADER_ONLY
+#include "hsjson.cc"
+#endif
 
 #endif
\ No newline at end of file
@@ -6,11 +6,65 @@
 #include <cmath>
 #include <any>
 #include <map>
-#include <sstream>
+#include <unordered_set>
+#include <algorithm>
+#include <ranges>
+#include <cstdlib>
+#include <new>
+#include <array>
+#include <cstdio>
+#include <thread>
 #include "hsjson.hh"
 
+#ifdef HSJSON_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HSJSON_ZSTD
+#include <zstd.h>
+#endif
+
 using namespace hs::json;
 
+static thread_local std::size_t g_allocations = 0;
+static thread_local std::size_t g_deallocations = 0;
+
+// Out of line, or GCC sees free() inlined against an operator new call and
+// reports them as mismatched
+[[gnu::noinline]] void *operator new(std::size_t size)
+{
+  ++g_allocations;
+  if (auto p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+  g_deallocations += p != nullptr;
+  std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept
+{
+  operator delete(p);
+}
+
+// Array forms too, so every allocation the tests make is counted the same
+[[gnu::noinline]] void *operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+[[gnu::noinline]] void operator delete[](void *p) noexcept
+{
+  operator delete(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p, std::size_t) noexcept
+{
+  operator delete(p);
+}
+
 void test_hsjson_parser()
 {
   auto normal_case = []()
@@ -361,7 +415,1948 @@ void test_hsjson_parser()
   json_generator_com();
 }
 
+void test_parse_stats()
+{
+  auto counts = []()
+  {
+    std::string str{R"({"name": "John Doe", "tags": ["a", "b"], "age": 14, "ok": true, "x": null})"};
+    parse_stats stats{};
+    auto object = parse(str, stats).get_as<json_object>();
+
+    assert(object.size() == 5);
+    assert(stats.bytes_consumed == str.size());
+    assert(stats.object_count == 1);
+    assert(stats.array_count == 1);
+    assert(stats.string_count == 8);
+    assert(stats.number_count == 1);
+    assert(stats.boolean_count == 1);
+    assert(stats.null_count == 1);
+    assert(stats.max_depth == 2);
+    assert(stats.string_bytes == 24);
+    assert(stats.allocation_count > 0);
+  };
+
+  auto observer = []()
+  {
+    struct counting_observer : parse_observer
+    {
+      int calls = 0;
+      void on_parse(parse_stats const &stats) override
+      {
+        ++calls;
+        assert(stats.array_count == 1);
+      }
+    } counter;
+
+    set_parse_observer(&counter);
+    parse("[1, 2]");
+    set_parse_observer(nullptr);
+    parse("[1, 2]");
+    assert(counter.calls == 1);
+  };
+
+  counts();
+  observer();
+}
+
+void test_memory_usage()
+{
+  auto categories = []()
+  {
+    std::string str{R"({"a long enough key to spill": "a string value that cannot fit inline", "list": [1, 2, 3]})"};
+    auto value = parse(str);
+    auto usage = value.memory_usage();
+
+    assert(usage.object_bytes > 0);
+    assert(usage.key_bytes > 0);
+    assert(usage.string_bytes > 0);
+    assert(usage.array_bytes >= 3 * sizeof(json_value));
+    assert(usage.total() > str.size());
+    assert(json_value{}.memory_usage().total() == 0);
+  };
+
+  auto shrink = []()
+  {
+    json_array array{};
+    for (int i = 0; i < 5; ++i)
+      array.push_back(json_number{double(i)});
+
+    auto before = array.memory_usage().array_bytes;
+    array.shrink_to_fit();
+    auto after = array.memory_usage().array_bytes;
+    assert(after == 5 * sizeof(json_value));
+    assert(after < before);
+  };
+
+  categories();
+  shrink();
+}
+
+void test_string_decoding()
+{
+  auto rejects = [](std::string const &str)
+  {
+    try
+    {
+      parse(str);
+    }
+    catch (int r)
+    {
+      assert(r == parse_error);
+      return true;
+    }
+    return false;
+  };
+
+  auto escapes = []()
+  {
+    std::string str{R"(["a\"b\\c\/d\b\f\n\r\t", "\u00e9\u20AC\ud83d\ude00"])"};
+    auto array = parse(str).get_as<json_array>();
+    assert(array.get_at(0).get_as<json_string>() == "a\"b\\c/d\b\f\n\r\t");
+    assert(array.get_at(1).get_as<json_string>() == "\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80");
+  };
+
+  auto long_runs = []()
+  {
+    // Specials on both sides of the vector block boundaries
+    std::string body(100, 'x');
+    body[15] = '\xC3';
+    body[16] = '\xA9';
+    body[47] = '\\';
+    body[48] = 'n';
+    auto value = parse('"' + body + '"').get_as<json_string>();
+    assert(value.size() == 99);
+    assert(value.substr(15, 2) == "\xC3\xA9");
+    assert(value[47] == '\n');
+  };
+
+  auto invalid = [rejects]()
+  {
+    assert(rejects("\"abc"));
+    assert(rejects("\"a\tb\""));
+    assert(rejects(R"("\x")"));
+    assert(rejects(R"("\u12")"));
+    assert(rejects(R"("\ud83d")"));
+    assert(rejects(R"("\ude00")"));
+    assert(rejects("\"\xC0\xAF\""));
+    assert(rejects("\"\xED\xA0\x80\""));
+    assert(rejects("\"\xF4\x90\x80\x80\""));
+    assert(rejects("\"\xE2\x82\""));
+  };
+
+  escapes();
+  long_runs();
+  invalid();
+}
+
+void test_parse_limits()
+{
+  auto fails_with = [](std::string const &str, parse_options const &options, int error)
+  {
+    try
+    {
+      parse(str, options);
+    }
+    catch (int r)
+    {
+      return r == error;
+    }
+    return false;
+  };
+
+  auto deep_nesting = [fails_with]()
+  {
+    std::string deep(1000000, '[');
+    assert(fails_with(deep, parse_options{}, limit_error));
+
+    parse_options options{};
+    options.max_depth = 3;
+    assert(fails_with("[[[[]]]]", options, limit_error));
+    auto array = parse("[[[]]]", options).get_as<json_array>();
+    assert(array.size() == 1);
+  };
+
+  auto sizes = [fails_with]()
+  {
+    parse_options options{};
+    options.max_document_size = 8;
+    assert(fails_with(R"(["abcdefgh"])", options, limit_error));
+
+    options = {};
+    options.max_string_length = 3;
+    assert(fails_with(R"({"key": "abcd"})", options, limit_error));
+    assert(fails_with(R"({"long": 1})", options, limit_error));
+    assert(parse(R"({"abc": "abc"})", options).get_as<json_object>().size() == 1);
+  };
+
+  auto grammar = [fails_with]()
+  {
+    parse_options options{};
+    assert(fails_with("[1 2]", options, parse_error));
+    assert(fails_with(R"({"a": 1 "b": 2})", options, parse_error));
+    assert(fails_with("[1,]", options, parse_error));
+    assert(fails_with("[1] x", options, parse_error));
+    assert(fails_with("[1}", options, parse_error));
+    assert(fails_with("01", options, parse_error));
+    assert(fails_with("truth", options, parse_error));
+
+    auto array = parse(" [-0.5e2, 1E+2, 3e-1, 0] ").get_as<json_array>();
+    assert(array.get_at(0).get_as<json_number>().get_value() == -50);
+    assert(array.get_at(1).get_as<json_number>().get_value() == 100);
+    assert(array.get_at(2).get_as<json_number>().get_value() == 0.3);
+  };
+
+  // Too large for a double is a limit, too small rounds to zero
+  auto out_of_range = [fails_with]()
+  {
+    parse_options options{};
+    std::string digits(400, '7');
+    for (auto text : {"1e999", "-1e999", "0.1e310", "123e99999999999999999999"})
+      assert(fails_with(text, options, limit_error));
+    assert(fails_with(digits, options, limit_error));
+    assert(fails_with(digits + ".5e-10", options, limit_error));
+
+    for (auto text : {"1e-999", "0.0001e-400", "1e-99999999999999999999"})
+      assert(parse(text).get_as<json_number>().get_value() == 0);
+    assert(std::signbit(parse("-1e-999").get_as<json_number>().get_value()));
+    assert(parse(digits + "e-800").get_as<json_number>().get_value() == 0);
+    assert(parse("1.7e308").get_as<json_number>().get_value() == 1.7e308);
+    assert(serialize(parse("[1e-999]")) == "[0]");
+  };
+
+  deep_nesting();
+  sizes();
+  grammar();
+  out_of_range();
+}
+
+void test_reusable_parser()
+{
+  auto warmed_up = []()
+  {
+    std::string str{R"({"id": 1, "name": "a name long enough to spill", "tags": ["a", "b"], "nested": {"ok": true}})"};
+    parser p{};
+
+    auto before = g_allocations;
+    auto cold = p.parse(str);
+    auto cold_allocations = g_allocations - before;
+
+    before = g_allocations;
+    auto warm = p.parse(str);
+    auto warm_allocations = g_allocations - before;
+
+    // Only the blocks owned by the tree itself remain
+    assert(warm_allocations == warm.memory_usage().allocations);
+    assert(warm_allocations < cold_allocations);
+    assert(warm.get_as<json_object>().get_attribute("tags").get_as<json_array>().size() == 2);
+  };
+
+  auto recovers_after_error = []()
+  {
+    parser p{};
+    try
+    {
+      p.parse(R"({"a": {"b": [1, 2, )");
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == parse_error);
+    }
+    auto object = p.parse(R"({"c": {}})").get_as<json_object>();
+    assert(object.size() == 1);
+    assert(object.get_attribute("c").get_as<json_object>().size() == 0);
+
+    p.options().max_depth = 1;
+    try
+    {
+      p.parse("[[]]");
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == limit_error);
+    }
+  };
+
+  warmed_up();
+  recovers_after_error();
+}
+
+void test_json_reader()
+{
+  auto walk = []()
+  {
+    std::string str{R"([
+      {"name": "Fletcher", "age": 24, "tags": ["a", ["b"]], "active": false, "spouse": null},
+      {"name": "Carol", "age": 21, "friends": [{"id": 0}], "active": true}
+    ])"};
+
+    auto before = g_allocations;
+    json_reader reader{str};
+    double ages = 0;
+    int active = 0;
+    std::string_view last_name{};
+
+    reader.enter_array();
+    while (reader.next())
+    {
+      reader.enter_object();
+      while (reader.next())
+      {
+        if (reader.key() == "age")
+          ages += reader.read_number();
+        else if (reader.key() == "name")
+          last_name = reader.read_string_view();
+        else if (reader.key() == "active")
+          active += reader.read_boolean();
+        else if (reader.key() == "tags")
+          reader.skip_value();
+        // anything else is skipped by next()
+      }
+    }
+    assert(not reader.next());
+    assert(g_allocations == before);
+
+    assert(ages == 45);
+    assert(active == 1);
+    assert(last_name == "Carol");
+    assert(last_name.data() > str.data() and last_name.data() < str.data() + str.size());
+  };
+
+  auto escapes = []()
+  {
+    json_reader reader{R"({"k\u0065y": "a\nb", "plain": "c"})"};
+    reader.enter_object();
+    assert(reader.next());
+    assert(reader.key() == "key");
+    assert(reader.read_string_view() == "a\nb");
+    assert(reader.next());
+    assert(reader.key() == "plain");
+    assert(reader.peek_type() == json_type::string);
+    assert(reader.read_string_view() == "c");
+    assert(not reader.next());
+    assert(reader.depth() == 0);
+  };
+
+  auto errors = []()
+  {
+    json_reader reader{"[1, true]"};
+    reader.enter_array();
+    assert(reader.next());
+    try
+    {
+      reader.read_string_view();
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == conversion_error);
+    }
+    assert(reader.read_number() == 1);
+    assert(reader.next());
+    assert(reader.read_boolean());
+
+    json_reader broken{"[1 2]"};
+    broken.enter_array();
+    assert(broken.next());
+    broken.read_number();
+    try
+    {
+      broken.next();
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == parse_error);
+      assert(broken.offset() == 3);
+    }
+  };
+
+  walk();
+  escapes();
+  errors();
+}
+
+void test_iterators()
+{
+  static_assert(std::ranges::bidirectional_range<json_object>);
+  static_assert(std::ranges::bidirectional_range<json_object const>);
+  static_assert(std::ranges::contiguous_range<json_array>);
+  static_assert(std::ranges::contiguous_range<json_array const>);
+
+  auto object_walk = []()
+  {
+    auto value = parse(R"({"b": 2, "a": 1, "c": "three"})");
+    auto &object = value.as<json_object>();
+
+    std::string keys{};
+    for (auto const &[key, attribute] : object)
+      keys += key;
+    assert(keys == "abc");
+
+    for (auto &[key, attribute] : object)
+      if (key == "a")
+        attribute = json_number{10};
+    assert(object.get_attribute("a").get_as<json_number>().get_value() == 10);
+
+    auto strings = std::ranges::count_if(object, [](auto const &member)
+                                         { return member.first == "c"; });
+    assert(strings == 1);
+  };
+
+  auto array_walk = []()
+  {
+    auto value = parse(R"([{"id": 1}, {"id": 2}, {"id": 3}])");
+    json_array const &array = value.as<json_array>();
+
+    auto before = g_allocations;
+    double sum = 0;
+    for (auto const &element : array)
+      for (auto const &[key, id] : element.as<json_object>())
+        sum += id.as<json_number>().get_value();
+    auto found = std::ranges::find_if(array, [](json_value const &element)
+                                      { return element.as<json_object>().has_attribute("id"); });
+    assert(g_allocations == before);
+    assert(sum == 6);
+    assert(found == array.begin());
+
+    auto ids = array | std::views::drop(1);
+    assert(std::ranges::distance(ids) == 2);
+  };
+
+  object_walk();
+  array_walk();
+}
+
+void test_schema_validation()
+{
+  auto schema = json_schema::compile(parse(R"({
+    "type": "array",
+    "items": {
+      "type": "object",
+      "required": ["name", "age"],
+      "properties": {
+        "name": {"type": "string", "minLength": 1, "maxLength": 20},
+        "age": {"type": "integer", "minimum": 0, "exclusiveMaximum": 150},
+        "eyeColor": {"enum": ["green", "brown", "blue"]},
+        "tags": {"type": "array", "items": {"type": "string"}, "maxItems": 3},
+        "friends/best": {"type": "null"}
+      }
+    }
+  })"));
+
+  auto raw_text = [schema]()
+  {
+    auto ok = schema.validate(R"([{"name": "Fletcher", "age": 24, "eyeColor": "green", "extra": {"x": [1]}}])");
+    assert(ok.valid);
+
+    auto bad_type = schema.validate(R"([{"name": "A", "age": 1}, {"name": "B", "age": 2.5}])");
+    assert(not bad_type.valid);
+    assert(bad_type.path == "/1/age");
+    assert(bad_type.offset == 47);
+
+    auto missing = schema.validate(R"([{"name": "A"}])");
+    assert(missing.path == "/0");
+    assert(missing.offset == 1);
+    assert(missing.message.find("age") != std::string::npos);
+
+    auto too_many = schema.validate(R"([{"name": "A", "age": 1, "tags": ["a", "b", "c", "d"]}])");
+    assert(too_many.path == "/0/tags");
+
+    auto escaped = schema.validate(R"([{"name": "A", "age": 1, "friends/best": 0}])");
+    assert(escaped.path == "/0/friends~1best");
+
+    assert(not schema.validate(R"([{"name": "A", "age": 1, "eyeColor": "red"}])").valid);
+    assert(not schema.validate(R"([{"name": "", "age": 1}])").valid);
+    assert(not schema.validate(R"([{"name": "A", "age": 150}])").valid);
+    assert(not schema.validate(R"({})").valid);
+  };
+
+  auto fused = [schema]()
+  {
+    schema_violation violation{};
+    parse_options options{};
+    options.schema = &schema;
+    options.violation = &violation;
+
+    auto array = parse(R"([{"name": "A", "age": 1}])", options).get_as<json_array>();
+    assert(array.size() == 1);
+    assert(violation.valid);
+
+    try
+    {
+      parse(R"([{"name": "A", "age": -1}, {"name": "B", "age": 2}])", options);
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == schema_error);
+    }
+    assert(not violation.valid);
+    assert(violation.path == "/0/age");
+  };
+
+  auto unsupported = []()
+  {
+    try
+    {
+      json_schema::compile(parse(R"({"anyOf": [{"type": "string"}]})"));
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == schema_error);
+    }
+  };
+
+  // Last duplicate wins in the tree, property bounds see one member
+  auto duplicate_keys = []()
+  {
+    auto at_least_two = json_schema::compile(parse(R"({"minProperties": 2})"));
+    assert(not at_least_two.validate(R"({"a": 1, "a": 2})").valid);
+    assert(at_least_two.validate(R"({"a": 1, "b": 2, "a": 3})").valid);
+    auto at_most_one = json_schema::compile(parse(R"({"maxProperties": 1})"));
+    assert(at_most_one.validate(R"({"a": 1, "a": 2})").valid);
+    assert(not at_most_one.validate(R"({"a": 1, "b": 2})").valid);
+
+    parse_options options{};
+    options.schema = &at_most_one;
+    assert(parse(R"({"a": 1, "a": 2})", options).as<json_object>().size() == 1);
+  };
+
+  raw_text();
+  fused();
+  unsupported();
+  duplicate_keys();
+}
+
+void test_projection()
+{
+  std::string records{R"([
+    {"_id": "64aa", "age": 24, "balance": "$3,392.65", "about": "long text", "tags": ["a", "b"],
+     "friends": [{"id": 0, "name": "Susie"}, {"id": 1, "name": "Henrietta"}], "extra": {"x": [1, {"y": 2}]}},
+    {"_id": "64ab", "age": 21, "balance": "$2,965.67", "about": "more text", "tags": [],
+     "friends": [{"id": 0, "name": "Carolyn"}]}
+  ])"};
+
+  auto projected = [records]()
+  {
+    auto projection = json_projection::compile({"/age", "/balance", "/tags", "/friends/name"});
+    parse_options options{};
+    options.projection = &projection;
+    auto value = parse(records, options);
+    auto full = parse(records);
+
+    auto const &array = value.as<json_array>();
+    assert(array.size() == 2);
+    auto const &first = array.begin()->as<json_object>();
+    assert(first.size() == 4);
+    assert(not first.has_attribute("about"));
+    assert(first.get_attribute("age").get_as<json_number>().get_value() == 24);
+    assert(first.get_attribute("tags").get_as<json_array>().size() == 2);
+
+    auto friends = first.get_attribute("friends");
+    for (auto const &buddy : friends.as<json_array>())
+    {
+      assert(buddy.as<json_object>().size() == 1);
+      assert(buddy.as<json_object>().has_attribute("name"));
+    }
+    assert(value.memory_usage().total() < full.memory_usage().total());
+  };
+
+  // Members the path only passes through are dropped when they are scalars
+  auto scalars_on_the_path = []()
+  {
+    auto projection = json_projection::compile({"/friends/name", "/age"});
+    parse_options options{};
+    options.projection = &projection;
+    auto value = parse(R"({"friends": 5, "age": {"years": 3}, "other": 1})", options);
+    assert(value == parse(R"({"age": {"years": 3}})"));
+
+    value = parse(R"({"friends": [null, {"name": "Susie", "id": 0}, "Carolyn"]})", options);
+    assert(value == parse(R"({"friends": [{"name": "Susie"}]})"));
+  };
+
+  auto whole_document = [records]()
+  {
+    auto projection = json_projection::compile({"/age", ""});
+    parse_options options{};
+    options.projection = &projection;
+    auto value = parse(records, options);
+    assert(value.as<json_array>().begin()->as<json_object>().size() == 7);
+  };
+
+  auto skipped_input_is_checked = []()
+  {
+    auto projection = json_projection::compile({"/a"});
+    parse_options options{};
+    options.projection = &projection;
+    try
+    {
+      parse(R"({"a": 1, "b": [1 2]})", options);
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == parse_error);
+    }
+  };
+
+  projected();
+  scalars_on_the_path();
+  whole_document();
+  skipped_input_is_checked();
+}
+
+void test_parse_in_situ()
+{
+  auto borrowed = []()
+  {
+    std::string text{R"({"name": "Susie", "tags": ["a", "b\né"], "nul": "x\u0000y"})"};
+    auto value = parse_in_situ(text);
+    auto const &object = value.as<json_object>();
+
+    auto name = object.get_attribute("name").get_as<json_string_ref>();
+    assert(name.view() == "Susie");
+    assert(name.c_str() > text.data() and name.c_str() < text.data() + text.size());
+    assert(name.view().data() == name.c_str() and name.c_str()[name.view().size()] == '\0');
+    assert((json_string_ref{"Susie", 3}.view() == "Sus" and json_string_ref{"Susie"}.view() == "Susie"));
+
+    auto tags = object.get_attribute("tags").get_as<json_array>();
+    assert(tags.begin()->type() == json_type::string);
+    assert((tags.begin() + 1)->get_as<std::string_view>() == "b\n\xc3\xa9");
+    assert((tags.begin() + 1)->get_as<json_string>() == "b\n\xc3\xa9");
+
+    // Embedded NULs cannot be terminated in place
+    auto nul = object.get_attribute("nul").get_as<json_string>();
+    assert(nul.size() == 3 and nul[1] == '\0');
+  };
+
+  auto materialize = []()
+  {
+    std::string text{R"(["abc"])"};
+    auto value = parse_in_situ(text);
+    auto &string = value.as<json_array>()[0].as<json_string>();
+    string += "d";
+    assert(value.as<json_array>()[0].get_as<std::string_view>() == "abcd");
+    assert(text.find("abc") != std::string::npos);
+  };
+
+  auto fewer_allocations = []()
+  {
+    std::string text{R"([)"};
+    for (int i = 0; i < 64; ++i)
+      text += R"("a string that does not fit in the small buffer", )";
+    text += R"("end"])";
+    auto buffer = text;
+
+    auto before = g_allocations;
+    auto owned = parse(text);
+    auto owned_allocations = g_allocations - before;
+    before = g_allocations;
+    auto borrowed = parse_in_situ(buffer);
+    auto borrowed_allocations = g_allocations - before;
+    assert(borrowed_allocations < owned_allocations);
+    assert(borrowed.memory_usage().total() < owned.memory_usage().total());
+  };
+
+  borrowed();
+  materialize();
+  fewer_allocations();
+}
+
+void test_hashing()
+{
+  auto structural = []()
+  {
+    auto a = parse(R"({"name": "Susie", "tags": ["a", "b"], "age": 0.0, "ok": true})");
+    auto b = parse(R"({"ok": true, "age": -0, "tags": ["a", "b"], "name": "Susie"})");
+    auto c = parse(R"({"ok": true, "age": 0, "tags": ["b", "a"], "name": "Susie"})");
+    assert(a == b);
+    assert(a.hash() == b.hash());
+    assert(not (a == c));
+    assert(a.hash() != c.hash());
+
+    std::string text{R"(["Susie"])"};
+    auto borrowed = parse_in_situ(text);
+    assert(borrowed == parse(R"(["Susie"])"));
+    assert(borrowed.hash() == parse(R"(["Susie"])").hash());
+
+    // Empty strings and keys hash like any other
+    assert(parse(R"({"": ""})").hash() == parse(R"({"": ""})").hash());
+    assert(parse(R"({"": ""})").hash() != parse(R"({"": "a"})").hash());
+    assert(json_value{json_string{}}.hash() == json_value{json_string_ref{""}}.hash());
+
+    std::unordered_set<json_value> seen{};
+    auto values = parse(R"([1, {"a": [1]}, 1, {"a": [1]}, "1"])");
+    for (auto const &element : values.as<json_array>())
+      seen.insert(element);
+    assert(seen.size() == 3);
+  };
+
+  auto hash_consed = []()
+  {
+    std::string records{"["};
+    for (int i = 0; i < 100; ++i)
+      records += R"({"id": )" + std::to_string(i % 10) +
+                 R"(, "about": "a description long enough to live on the heap", "tags": ["velit", "enim"],)" +
+                 R"( "friends": [{"id": 0, "name": "Carolyn"}, {"id": 1, "name": "Henrietta"}]}, )";
+    records += "null]";
+
+    json_pool pool{};
+    parse_options options{};
+    options.pool = &pool;
+    auto shared = parse(records, options);
+    auto plain = parse(records);
+    assert(shared == plain);
+    assert(shared.hash() == plain.hash());
+
+    // Ten distinct records, each with the same tags, friends and about
+    auto const &array = shared.as<json_array>();
+    assert(*array.begin() == *(array.begin() + 10));
+    assert(pool.size() < 20);
+    assert(shared.memory_usage().total() + pool.memory_usage().total() < plain.memory_usage().total() / 10);
+
+    // Interning another document reuses the nodes
+    auto size = pool.size();
+    auto again = pool.intern(parse(records));
+    assert(pool.size() == size);
+    assert(again == shared);
+
+    // Modifying one copy leaves the others alone
+    auto copy = shared;
+    copy.as<json_array>()[0].as<json_object>()["tags"].as<json_array>().push_back(json_null{});
+    assert(not (copy == shared));
+    assert((array.begin() + 10)->get_as<json_object>().get_attribute("tags").get_as<json_array>().size() == 2);
+    assert(copy.as<json_array>()[10].as<json_object>().get_attribute("tags").get_as<json_array>().size() == 2);
+
+    // Nodes outlive the pool
+    pool.clear();
+    assert(pool.size() == 0);
+    assert(shared == plain);
+  };
+
+  structural();
+  hash_consed();
+}
+
+void test_columns()
+{
+  auto inferred = []()
+  {
+    auto records = parse(R"([
+      {"name": "Fletcher", "age": 24, "active": false, "tags": ["a"], "spouse": null},
+      {"age": 21, "name": "Carol", "active": true, "tags": []},
+      {"name": "Pate", "spouse": "Lynne", "age": null}
+    ])");
+    auto table = to_columns(records.as<json_array>());
+    assert(table.rows == 3);
+    assert(table.columns.size() == 4);
+
+    // Tags are not columnar
+    auto const &age = table["age"];
+    assert(age.type == json_type::number);
+    assert(age.numbers.size() == 3 and age.numbers[0] == 24 and age.numbers[1] == 21);
+    assert(not age.is_null(1) and age.is_null(2));
+
+    auto const &active = table["active"];
+    assert(active.type == json_type::boolean);
+    assert(not active.boolean(0) and active.boolean(1) and active.is_null(2));
+
+    auto const &spouse = table["spouse"];
+    assert(spouse.type == json_type::string);
+    assert(spouse.is_null(0) and spouse.is_null(1) and spouse.string(2) == "Lynne");
+    assert(table["name"].string(1) == "Carol");
+
+    // Columns follow the first record holding them, key order within it,
+    // whichever overload reads the records
+    std::string text{R"([{"b": 1, "a": 2}, {"d": 3, "a": 1, "c": null}, {"e": 5}])"};
+    for (auto const &columns : {to_columns(text), to_columns(parse(text).as<json_array>())})
+    {
+      std::string names{};
+      for (auto const &column : columns.columns)
+        names += column.name;
+      assert(names == "abcde");
+      assert(columns["d"].numbers[1] == 3 and columns["b"].is_null(2));
+    }
+  };
+
+  auto supplied = []()
+  {
+    std::string text{R"([{"id": 1, "name": "a", "extra": [1]}, {"name": "b"}, {"id": 3, "name": "c"}])"};
+    auto table = to_columns(text, {{"id", json_type::number}, {"missing", json_type::string}});
+    assert(table.columns.size() == 2);
+    assert(table.columns[0].name == "id");
+    assert(table["id"].numbers[2] == 3 and table["id"].is_null(1));
+    assert(table["missing"].is_null(0) and table["missing"].string(0).empty());
+
+    try
+    {
+      to_columns(text, {{"name", json_type::number}});
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == conversion_error);
+    }
+  };
+
+  auto parallel = []()
+  {
+    std::string text{"["};
+    for (int i = 0; i < 10000; ++i)
+    {
+      if (i)
+        text += ", ";
+      text += R"({"index": )" + std::to_string(i) + R"(, "name": "user)" + std::to_string(i) + '"';
+      if (i % 3)
+        text += R"(, "isActive": )" + std::string{i % 2 ? "true" : "false"};
+      if (i >= 9000)
+        text += R"(, "late": )" + std::to_string(i);
+      text += "}";
+    }
+    text += "]";
+
+    auto serial = to_columns(text);
+    auto threaded = to_columns(text, {}, 4);
+    auto records = parse(text);
+    auto from_tree = to_columns(records.as<json_array>(), {}, 4);
+    assert(serial.rows == 10000 and threaded.rows == 10000 and from_tree.rows == 10000);
+
+    for (auto const *table : {&threaded, &from_tree})
+    {
+      assert(table->columns.size() == serial.columns.size());
+      for (auto const &column : serial.columns)
+      {
+        auto const &other = (*table)[column.name];
+        assert(other.type == column.type);
+        assert(other.numbers == column.numbers);
+        assert(other.booleans == column.booleans);
+        assert(other.characters == column.characters);
+        assert(other.offsets == column.offsets);
+        assert(other.nulls == column.nulls);
+      }
+    }
+
+    auto const &late = threaded["late"];
+    assert(late.is_null(8999) and not late.is_null(9000) and late.numbers[9999] == 9999);
+    assert(threaded["isActive"].is_null(9999) and threaded["isActive"].boolean(9997));
+    assert(threaded["name"].string(5000) == "user5000");
+
+    // Record bounds come from a structural scan, the records themselves
+    // are still checked in full
+    for (auto const *str : {R"([{"a": 1} {"a": 2}])", R"([{"a": 1},])", R"([{"a": 1}] x)", R"([{"a": 1}, {"a": "]}])",
+                            R"([{"a": [1}])", R"([{"a": tru}])", R"([{"a": 1},, {"a": 2}])", "[{\"a\": 1}"})
+    {
+      try
+      {
+        to_columns(std::string_view{str}, {}, 4);
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == parse_error);
+      }
+    }
+    assert(to_columns(std::string_view{" [ ] "}, {}, 4).rows == 0);
+    assert(to_columns(std::string_view{R"([{"a": "]}\""}, {"a": "x"} ])"}, {}, 4).rows == 2);
+
+    // Long enough to be split, padded so the scan runs on malformed input
+    std::string padding(32 * 1024, ' ');
+    for (auto const *str : {R"([{"a": 1} {"a": 2}])", R"([{"a": 1},])", R"([{"a": 1}] x)", R"([{"a": [1}])"})
+    {
+      try
+      {
+        to_columns(padding + str, {}, 4);
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == parse_error);
+      }
+    }
+    assert(to_columns(padding + " [ ] " + padding, {}, 4).rows == 0);
+
+    // Nesting counts from the document either way
+    std::string nested{"["};
+    for (int i = 0; i < 10000; ++i)
+      nested += std::string{i ? "," : ""} + R"({"a": 1, "b": {"c": 2}})";
+    nested += "]";
+    parse_options options{};
+    options.max_depth = 2;
+    for (std::size_t threads : {1, 4})
+    {
+      try
+      {
+        to_columns(nested, {}, threads, options);
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == limit_error);
+      }
+    }
+    options.max_depth = 3;
+    assert(to_columns(nested, {}, 1, options).rows == 10000 and to_columns(nested, {}, 4, options).rows == 10000);
+  };
+
+  inferred();
+  supplied();
+  parallel();
+}
+
+void test_json_writer()
+{
+  auto streaming = []()
+  {
+    struct
+    {
+      std::string out{};
+      std::size_t flushes = 0;
+    } sent{};
+    sent.out.reserve(1024);
+    std::array<char, 16> buffer{};
+
+    // A sink capturing one pointer fits std::function without allocating
+    auto before = g_allocations;
+    {
+      json_writer writer{[&sent](std::string_view data)
+                         {
+                           ++sent.flushes;
+                           sent.out += data;
+                         },
+                         buffer};
+      writer.begin_object();
+      writer.key("name");
+      writer.value("Fletcher \"F\"\n");
+      writer.key("age");
+      writer.value(24);
+      writer.key("balance");
+      writer.value(3392.65);
+      writer.key("tags");
+      writer.begin_array();
+      writer.value(true);
+      writer.value(nullptr);
+      writer.value("\x01\xc3\xa9");
+      writer.end_array();
+      writer.key("empty");
+      writer.begin_object();
+      writer.end_object();
+      writer.end_object();
+      writer.flush();
+      assert(writer.bytes_written() == sent.out.size());
+    }
+    assert(g_allocations == before);
+    assert(sent.flushes > 1);
+    auto const &out = sent.out;
+    assert(out == R"({"name":"Fletcher \"F\"\n","age":24,"balance":3392.65,"tags":[true,null,"\u0001é"],"empty":{}})");
+    assert(parse(out).as<json_object>().get_attribute("name").get_as<json_string>() == "Fletcher \"F\"\n");
+  };
+
+  auto round_trip = []()
+  {
+    auto value = parse(R"({"b": [1, 2.5, -0.001, 1e300], "a": {"x": "é\t"}, "c": [], "d": false})");
+    auto text = serialize(value);
+    assert(text == R"({"a":{"x":"é\t"},"b":[1,2.5,-0.001,1e+300],"c":[],"d":false})");
+    assert(parse(text) == value);
+  };
+
+  auto to_file = []()
+  {
+    auto file = std::tmpfile();
+    {
+      json_writer writer{json_writer::fd_sink(fileno(file)), 8};
+      writer.begin_array();
+      for (int i = 0; i < 100; ++i)
+        writer.value(i);
+      writer.end_array();
+    }
+    std::rewind(file);
+    std::string text(1024, '\0');
+    text.resize(std::fread(text.data(), 1, text.size(), file));
+    std::fclose(file);
+    assert(parse(text).as<json_array>().size() == 100);
+  };
+
+  auto malformed = []()
+  {
+    auto expect_error = [](auto calls)
+    {
+      json_writer writer{[](std::string_view) {}};
+      try
+      {
+        calls(writer);
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == write_error);
+      }
+    };
+#ifndef NDEBUG
+    expect_error([](json_writer &writer) { writer.begin_object(); writer.value(1); });
+    expect_error([](json_writer &writer) { writer.begin_array(); writer.key("a"); });
+    expect_error([](json_writer &writer) { writer.begin_array(); writer.end_object(); });
+    expect_error([](json_writer &writer) { writer.value(1); writer.value(2); });
+#endif
+    expect_error([](json_writer &writer) { writer.value(std::nan("")); });
+  };
+
+  streaming();
+  round_trip();
+  to_file();
+  malformed();
+}
+
+void test_parse_compressed()
+{
+  std::string records{"["};
+  for (int i = 0; i < 500; ++i)
+  {
+    if (i)
+      records += ",\n";
+    records += R"({"index": )" + std::to_string(i) + R"(, "name": "user \")" + std::to_string(i) +
+               R"(\"", "tags": ["a", "]"], "nested": {"x": [1, {}]}})";
+  }
+  records += "]";
+
+  // Hands out the input a few bytes at a time
+  auto source_of = [](std::string const &input, std::size_t step)
+  {
+    return [&input, step, offset = std::size_t{0}](std::span<char> buffer) mutable
+    {
+      auto n = std::min<std::size_t>({buffer.size(), step, input.size() - offset});
+      std::copy_n(input.data() + offset, n, buffer.data());
+      offset += n;
+      return n;
+    };
+  };
+
+  auto elements = [&](std::string const &input, pipeline_options const &options, std::size_t step = 37)
+  {
+    std::vector<json_value> values{};
+    parse_compressed(source_of(input, step), [&](json_value &&value) { values.push_back(std::move(value)); },
+                     options);
+    return values;
+  };
+
+  auto plain = [&]()
+  {
+    pipeline_options options{};
+    options.buffer_size = 11;
+    options.buffer_count = 2;
+    pipeline_stats stats{};
+    options.stats = &stats;
+    auto values = elements(records, options);
+    assert(values.size() == 500);
+    assert(values[499].as<json_object>().get_attribute("name").get_as<json_string>() == "user \"499\"");
+    assert(stats.element_count == 500);
+    assert(stats.compressed_bytes == records.size() and stats.decompressed_bytes == records.size());
+
+    auto lines = elements("{\"a\": 1}\n[2]\n\"three\" 4 true\n", options);
+    assert(lines.size() == 5);
+    assert(lines[2].get_as<json_string>() == "three");
+    assert(lines[3].get_as<json_number>().get_value() == 4);
+    assert(elements("[]", options).empty() and elements("  ", options).empty());
+
+    // "80" also reads as a zlib header, plain text is never taken for one
+    auto numbers = elements("80\n81\n", options);
+    assert(numbers.size() == 2 and numbers[1].get_as<json_number>().get_value() == 81);
+    assert(elements("[800, 1]", options).size() == 2);
+
+    // JSON lines starting with an array are only split as such when named
+    std::string arrays = "[1, 2]\n[3]\n";
+    options.framing = element_framing::sequence;
+    lines = elements(arrays, options);
+    assert(lines.size() == 2 and lines[1].as<json_array>().size() == 1);
+    assert(elements("1 2", options).size() == 2);
+    options.framing = element_framing::array;
+    assert(elements(arrays.substr(0, 7), options).size() == 2);
+    for (auto const &input : {std::string{"1 2"}, std::string{"{}"}, std::string{}, arrays})
+    {
+      try
+      {
+        elements(input, options);
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == parse_error);
+      }
+    }
+  };
+
+  auto malformed = [&]()
+  {
+    for (std::string input : {"[1, 2", "[1 2]", "[1,]", "{\"a\": 1", "[1] 2"})
+    {
+      try
+      {
+        elements(input, {});
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == parse_error);
+      }
+    }
+  };
+
+#ifdef HSJSON_ZLIB
+  auto gzip = [&]()
+  {
+    std::string compressed(compressBound(records.size()) + 32, '\0');
+    z_stream stream{};
+    deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    stream.next_in = reinterpret_cast<Bytef *>(records.data());
+    stream.avail_in = records.size();
+    stream.next_out = reinterpret_cast<Bytef *>(compressed.data());
+    stream.avail_out = compressed.size();
+    deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    pipeline_options options{};
+    options.buffer_size = 64;
+    pipeline_stats stats{};
+    options.stats = &stats;
+    auto values = elements(compressed, options);
+    assert(values.size() == 500);
+    assert(stats.compressed_bytes == compressed.size());
+    assert(stats.decompressed_bytes == records.size());
+
+    // The magic bytes are looked for across reads
+    assert(elements(compressed, options, 1).size() == 500);
+
+    try
+    {
+      elements(compressed.substr(0, compressed.size() / 2), options);
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == compression_error);
+    }
+  };
+
+  // Raw zlib is only read when asked for
+  auto zlib = [&]()
+  {
+    std::string compressed(compressBound(records.size()), '\0');
+    auto size = static_cast<uLongf>(compressed.size());
+    compress(reinterpret_cast<Bytef *>(compressed.data()), &size, reinterpret_cast<Bytef const *>(records.data()),
+             records.size());
+    compressed.resize(size);
+
+    pipeline_options options{};
+    options.format = compression_format::zlib;
+    assert(elements(compressed, options).size() == 500);
+  };
+  gzip();
+  zlib();
+#endif
+
+#ifdef HSJSON_ZSTD
+  auto zstd = [&]()
+  {
+    std::string compressed(ZSTD_compressBound(records.size()), '\0');
+    auto size = ZSTD_compress(compressed.data(), compressed.size(), records.data(), records.size(), 1);
+    assert(not ZSTD_isError(size));
+    compressed.resize(size);
+
+    pipeline_options options{};
+    options.buffer_size = 64;
+    pipeline_stats stats{};
+    options.stats = &stats;
+    auto values = elements(compressed, options);
+    assert(values.size() == 500);
+    assert(values[499].as<json_object>().get_attribute("index").get_as<json_number>().get_value() == 499);
+    assert(stats.compressed_bytes == compressed.size());
+    assert(stats.decompressed_bytes == records.size());
+    assert(elements(compressed, options, 1).size() == 500);
+
+    // Concatenated frames continue the text
+    std::string lines = "{\"a\": 1}\n";
+    std::string frame(ZSTD_compressBound(lines.size()), '\0');
+    frame.resize(ZSTD_compress(frame.data(), frame.size(), lines.data(), lines.size(), 1));
+    assert(elements(frame + frame + frame, options).size() == 3);
+
+    for (auto const &corrupt : {compressed.substr(0, compressed.size() / 2), compressed.substr(0, 4) + "garbage"})
+    {
+      try
+      {
+        elements(corrupt, options);
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == compression_error);
+      }
+    }
+  };
+  zstd();
+#endif
+
+  plain();
+  malformed();
+}
+
+void test_validate()
+{
+  // validate() must agree with parse() on every document
+  auto agrees = [](std::string const &str, parse_options const &options = {})
+  {
+    int error = 0;
+    try
+    {
+      parse(str, options);
+    }
+    catch (int r)
+    {
+      error = r;
+    }
+    auto result = validate(str, options);
+    return result.valid == (error == 0) and result.error == error;
+  };
+
+  auto documents = [agrees]()
+  {
+    for (auto const *str : {R"({"a": [1, -0.5e2, 1E+2, true, false, null, "x\u00e9\ud83d\ude00"]})",
+                            " [ ] ", "{}", "0", "\"\xC3\xA9\xF0\x9F\x98\x80\"", "[[[{\"k\": {}}]]]",
+                            "", " ", "[1 2]", "[1,]", "{\"a\" 1}", "{\"a\": 1,}", "{1: 2}", "[1}", "[1] x",
+                            "01", "-", "1.", ".5", "1e", "+1", "truth", "tru", "nul", "\"abc", "\"a\tb\"",
+                            R"("\x")", R"("\u12")", R"("\ud83d")", R"("\ude00")", "\"\xC0\xAF\"",
+                            "\"\xED\xA0\x80\"", "\"\xF4\x90\x80\x80\"", "\"\xE2\x82\"", "[\"a\"]]"})
+      assert(agrees(str));
+  };
+
+  auto offsets = []()
+  {
+    auto result = validate(R"({"a": [1, 2,, 3]})");
+    assert(not result.valid and result.error == parse_error and result.offset == 12);
+    assert(validate("[\"ab\xC0\"]").offset == 4);
+    assert(validate(R"(["\q"])").offset == 2);
+    assert(validate("[1, 2").offset == 5);
+    assert(validate(R"({"a": 1} {})").offset == 9);
+
+    // Whitespace runs long enough to be skipped a block at a time
+    std::string padded = "[" + std::string(40, ' ') + "1," + std::string(37, '\n') + "x]";
+    assert(validate(padded).offset == padded.find('x'));
+    assert(validate("[" + std::string(40, '\t') + "1\r\n]").valid);
+  };
+
+  auto limits = [agrees]()
+  {
+    std::string deep(5000, '[');
+    auto result = validate(deep);
+    assert(result.error == limit_error and result.offset == 1024);
+    assert(agrees(deep));
+
+    parse_options options{};
+    options.max_depth = 3;
+    assert(validate("[[[]]]", options).valid);
+    assert(validate("[{\"a\": [[]]}]", options).error == limit_error);
+
+    // Past the inline depth the bits move to the heap
+    options.max_depth = std::numeric_limits<std::size_t>::max();
+    for (std::size_t levels : {4096, 4097, 5000})
+    {
+      auto nested = std::string(levels, '[') + std::string(levels, ']');
+      assert(validate(nested, options).valid and agrees(nested, options));
+      nested = std::string(levels - 1, '[') + "{\"a\": 1}" + std::string(levels - 1, ']');
+      assert(validate(nested, options).valid and agrees(nested, options));
+      assert(agrees(nested.substr(0, nested.size() - 1) + "}", options));
+    }
+    auto nested = std::string(20000, '[') + std::string(20000, ']');
+    assert(validate(nested, options).valid);
+    assert(validate(deep, options).error == parse_error and agrees(deep, options));
+    options.max_depth = 5000;
+    assert(validate(deep + "[", options).offset == 5000 and agrees(deep + "[", options));
+
+    options = {};
+    options.max_document_size = 4;
+    assert(validate("[12]", options).valid);
+    assert(validate("[123]", options).error == limit_error);
+
+    // String limits count decoded bytes, keys included
+    options = {};
+    options.max_string_length = 4;
+    for (auto const *str : {R"(["abcd"])", R"(["abcde"])", R"(["éé"])", R"(["ééx"])",
+                            R"(["😀"])", R"(["a😀"])", R"(["€
+"])", R"({"abcde": 1})",
+                            "[\"\xC3\xA9\xC3\xA9\"]", "[\"\xC3\xA9\xC3\xA9!\"]", R"(["abcdef)"})
+      assert(agrees(str, options));
+    assert(validate(R"(["abc", "abcde"])", options).offset == 13);
+
+    // Numbers too large for a double
+    for (auto const *str : {"1e308", "1.7976931348623157e308", "1.8e308", "[-1e999]", "0.1e310", "1e-999"})
+      assert(agrees(str));
+  };
+
+  auto no_allocations = []()
+  {
+    std::string str{R"({"key": ["value\n\u00e9", 1.5e3, {"nested": [true, null]}], "more": "\ud83d\ude00"})"};
+    auto before = g_allocations;
+    for (int i = 0; i < 100; ++i)
+      assert(validate(str).valid);
+    assert(g_allocations == before);
+  };
+
+  documents();
+  offsets();
+  limits();
+  no_allocations();
+}
+
+void test_reformat()
+{
+  std::string pretty = R"({
+  "name": "a  b\" {c}",
+  "list": [
+    1,
+    -2.5e3,
+    true
+  ],
+  "empty": {},
+  "none": [],
+  "nested": {
+    "x": null
+  }
+})";
+  std::string compact = R"({"name":"a  b\" {c}","list":[1,-2.5e3,true],"empty":{},"none":[],"nested":{"x":null}})";
+
+  auto round_trip = [&]()
+  {
+    assert(minify(pretty) == compact);
+    assert(prettify(compact) == pretty);
+    assert(prettify(pretty) == pretty);
+    assert(prettified_size(compact) == pretty.size());
+    assert(prettify("\t[ 1 ,\r\n\"x\" ] ", 4) == "[\n    1,\n    \"x\"\n]");
+    assert(prettify("[ { } , [ ] ]") == "[\n  {},\n  []\n]");
+    assert(minify(" 42 ") == "42");
+  };
+
+  auto long_runs = [&]()
+  {
+    // Whitespace and quotes on both sides of the vector block boundaries
+    std::string text = "[" + std::string(45, ' ') + "\"" + std::string(40, ' ') + "\\\\\"" + std::string(70, '\n') + "]";
+    assert(minify(text) == "[\"" + std::string(40, ' ') + "\\\\\"]");
+  };
+
+  auto long_documents = []()
+  {
+    // Escapes, strings and whitespace runs across every block offset,
+    // checked against a byte at a time reference
+    std::string text = "[";
+    for (int i = 0; i < 300; ++i)
+      text += std::string(i % 7, ' ') + (i % 11 ? R"({"key": "v a", "n":)" : R"({"k\"ey": "v a\\", "n":)") +
+              std::string(i % 23, '\n') + std::to_string(i) + (i % 5 ? R"(, "s": "  [ ]  "})" : "}") + ",\t";
+    text += "null]";
+
+    std::string expected;
+    bool in_string = false, escaped = false;
+    for (char c : text)
+    {
+      if (in_string or (c != ' ' and c != '\n' and c != '\t'))
+        expected += c;
+      if (escaped)
+        escaped = false;
+      else if (in_string and c == '\\')
+        escaped = true;
+      else if (c == '"')
+        in_string = not in_string;
+    }
+    assert(minify(text) == expected);
+    assert(minify(prettify(text)) == expected);
+
+    std::string in_place = text;
+    in_place.resize(minify(in_place, in_place));
+    assert(in_place == expected);
+  };
+
+  auto buffers = [&]()
+  {
+    // In place, and within fixed buffers without allocating
+    std::string in_place = pretty;
+    in_place.resize(minify(in_place, in_place));
+    assert(in_place == compact);
+
+    std::array<char, 256> buffer{};
+    auto before = g_allocations;
+    auto size = prettify(compact, buffer);
+    auto small = minify(pretty, std::span<char>{buffer}.subspan(size));
+    assert(g_allocations == before);
+    assert(std::string_view(buffer.data(), size) == pretty);
+    assert(std::string_view(buffer.data() + size, small) == compact);
+
+    try
+    {
+      prettify(compact, std::span<char>{buffer}.first(pretty.size() - 1));
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == write_error);
+    }
+  };
+
+  auto malformed = []()
+  {
+    auto expect_error = [](auto transform, char const *str)
+    {
+      try
+      {
+        transform(str);
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == parse_error);
+      }
+    };
+    auto pretty = [](char const *str) { return prettify(str); };
+    auto compact = [](char const *str) { return minify(str); };
+
+    for (auto const *str : {"[\"abc", "[\"abc\\", "[1]]", "{\"a\": [1}"})
+      expect_error(pretty, str);
+    for (auto const *str : {"[\"abc", "[\"abc\\", "{\"a\": \"b"})
+      expect_error(compact, str);
+
+    // Brackets are not matched, only copied
+    assert(minify("[1 ]]") == "[1]]");
+  };
+
+  round_trip();
+  long_runs();
+  long_documents();
+  buffers();
+  malformed();
+}
+
+void test_tape()
+{
+  std::string text{R"({"name": "tape", "version": 1.5, "flags": [true, false, null], "nested": {"a": [], "b": {}},
+                      "repeat": ["name", "name"], "nul": "a\u0000b"})"};
+  auto tree = parse(text);
+  auto tape = make_tape(tree);
+
+  auto reads = [&]()
+  {
+    json_view root{tape};
+    assert(root.type() == json_type::object and root.size() == 6);
+    assert(root.get_attribute("name").get_as<std::string_view>() == "tape");
+    assert(root.get_attribute("version").get_as<json_number>().get_value() == 1.5);
+    auto flags = root.get_attribute("flags");
+    assert(flags.size() == 3 and flags.get_at(0).get_as<json_boolean>().get_value());
+    assert(not flags.get_at(1).get_as<json_boolean>().get_value());
+    assert(flags.get_at(2).type() == json_type::null);
+    assert(root.get_attribute("nested").get_attribute("b").size() == 0);
+    assert(root.get_attribute("nul").get_as<json_string>() == std::string("a\0b", 3));
+    assert(root.key_at(0) == "flags" and root.get_at(0).size() == 3);
+    assert(not root.has_attribute("missing"));
+    assert(root.to_value() == tree);
+  };
+
+  auto errors = [&]()
+  {
+    json_view root{tape};
+    for (auto access : {+[](json_view v) { v.get_attribute("missing"); }, +[](json_view v) { v.get_at(6); },
+                        +[](json_view v) { v.get_attribute("flags").get_at(3); }})
+      try
+      {
+        access(root);
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == invalid_access);
+      }
+    try
+    {
+      root.get_attribute("name").get_as<json_number>();
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == conversion_error);
+    }
+
+    auto corrupt = tape;
+    corrupt[0] = 'X';
+    for (auto bytes : {std::span<char const>{corrupt}, std::span<char const>{tape}.first(16)})
+      try
+      {
+        json_view{bytes};
+        assert(false);
+      }
+      catch (int r)
+      {
+        assert(r == parse_error);
+      }
+  };
+
+  auto relocated = [&]()
+  {
+    // Any address will do, offsets are relative to the start of the tape
+    std::vector<char> moved(tape.size() + 1);
+    std::copy(tape.begin(), tape.end(), moved.begin() + 1);
+    json_view root{std::span<char const>{moved}.subspan(1)};
+    assert(root.to_value() == tree);
+    assert(root.get_attribute("repeat").get_at(1).get_as<std::string_view>() == "name");
+  };
+
+  auto indexed = []()
+  {
+    // Large enough to carry a hash index, looked up without allocating
+    json_object object{};
+    for (int i = 0; i < 100; ++i)
+      object.insert_attribute("key" + std::to_string(i), json_number{static_cast<double>(i)});
+    auto big = make_tape(object);
+    json_view root{big};
+    auto before = g_allocations;
+    for (int i = 0; i < 100; ++i)
+    {
+      char name[16];
+      std::snprintf(name, sizeof(name), "key%d", i);
+      assert(root.get_attribute(name).get_as<json_number>().get_value() == i);
+    }
+    assert(not root.has_attribute("key100") and not root.has_attribute(""));
+    assert(g_allocations == before);
+  };
+
+  reads();
+  errors();
+  relocated();
+  indexed();
+}
+
+void test_packed_arrays()
+{
+  parse_options packing{};
+  packing.pack_arrays = true;
+
+  auto parsed = [&packing]()
+  {
+    auto value = parse(R"({"position": [25.1212, 55.1535], "flags": [true, false], "mixed": [1, true],
+                          "nested": [[1, 2], [3]], "empty": []})", packing);
+    auto const &object = value.as<json_object>();
+
+    auto position = object.get_attribute("position").get_as<json_array>();
+    assert(position.packed());
+    auto numbers = position.as_span<double>();
+    assert(numbers.size() == 2 and numbers[0] == 25.1212 and numbers[1] == 55.1535);
+    assert(position.get_at(1).get_as<json_number>().get_value() == 55.1535);
+
+    auto flags = object.get_attribute("flags").get_as<json_array>();
+    assert(flags.as_span<json_boolean>().size() == 2 and flags.as_span<json_boolean>()[0].get_value());
+    assert(not object.get_attribute("mixed").get_as<json_array>().packed());
+    assert(not object.get_attribute("nested").get_as<json_array>().packed());
+    assert(object.get_attribute("nested").get_as<json_array>().get_at(0).get_as<json_array>().packed());
+    assert(object.get_attribute("empty").get_as<json_array>().as_span<double>().empty());
+
+    try
+    {
+      flags.as_span<double>();
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == conversion_error);
+    }
+
+    // Only on request
+    assert(not parse("[1, 2]").as<json_array>().packed());
+  };
+
+  auto element_interface = []()
+  {
+    json_array packed{std::vector<double>{1, 2, 3}};
+    json_array boxed{};
+    for (double n : {1, 2, 3})
+      boxed.push_back(json_number{n});
+    assert(packed == boxed and boxed == packed);
+    assert(json_value{packed}.hash() == json_value{boxed}.hash());
+    assert(serialize(packed) == "[1,2,3]");
+
+    double sum = 0;
+    json_array const &view = packed;
+    for (auto const &element : view)
+      sum += element.as<json_number>().get_value();
+    assert(sum == 6 and (view.begin() + 2)->get_as<json_number>().get_value() == 3);
+
+    // Same type stays packed, anything else boxes the elements first
+    packed.push_back(json_number{4});
+    assert(packed.packed() and packed.as_span<double>().size() == 4);
+    packed[0] = json_number{10};
+    assert(not packed.packed() and packed.get_at(0).get_as<json_number>().get_value() == 10);
+    assert(packed.pack() and packed.as_span<double>()[0] == 10);
+    packed.push_back(json_string{"x"});
+    assert(not packed.packed() and packed.size() == 5);
+    assert(not packed.pack());
+  };
+
+  // Const iteration of a packed array walks a boxed copy that stays with it
+  auto views = [&packing]()
+  {
+    std::string text = "[1.5, 2.5, 3.5]";
+    for (auto const &options : {parse_options{}, packing})
+    {
+      auto value = parse(text, options);
+      auto const &array = value.as<json_array>();
+      assert(array.packed() == options.pack_arrays);
+
+      std::vector<double> reversed;
+      for (auto const &element : array | std::views::reverse)
+        reversed.push_back(element.as<json_number>().get_value());
+      assert((reversed == std::vector<double>{3.5, 2.5, 1.5}));
+      assert(std::ranges::data(array) + 2 == &array.begin()[2]);
+    }
+
+    // Readers on several threads publish a single copy between them
+    json_array const shared{std::vector<double>(1000, 0.5)};
+    std::vector<json_value const *> firsts(4);
+    std::vector<std::thread> readers;
+    for (auto &first : firsts)
+      readers.emplace_back([&shared, &first]() { first = &*shared.begin(); });
+    for (auto &reader : readers)
+      reader.join();
+    assert(std::ranges::all_of(firsts, [&](auto first) { return first == &*shared.begin(); }));
+    assert(shared.packed() and serialize(json_value{shared}).size() == 1 + 1000 * 4);
+
+    // Changing the array drops the copy
+    json_array grown{std::vector<double>{1, 2}};
+    json_array const &view = grown;
+    assert(view.begin()[1].as<json_number>().get_value() == 2);
+    grown.push_back(json_number{3});
+    assert(view.end() - view.begin() == 3 and view.begin()[2].as<json_number>().get_value() == 3);
+  };
+
+  auto memory = [&packing]()
+  {
+    std::string series = "[";
+    for (int i = 0; i < 1000; ++i)
+      series += (i ? "," : "") + std::to_string(i * 0.5);
+    series += "]";
+
+    auto value = parse(series, packing);
+    auto packed_bytes = value.memory_usage().total();
+    value.as<json_array>().begin(); // unpacks
+    auto boxed_bytes = value.memory_usage().total();
+    // Arrays not packed pay nothing for the packed state
+    static_assert(sizeof(json_array) == sizeof(json_array::container_type) + sizeof(void *));
+
+    // Half the element bytes, packed arrays also hold a small side block
+    assert(packed_bytes * 2 <= boxed_bytes + 256);
+    assert(value == parse(series));
+  };
+
+  parsed();
+  element_interface();
+  views();
+  memory();
+}
+
+void test_reclaimer()
+{
+  std::string str{R"({"name": "a name long enough to spill", "items": [{"id": 1}, {"id": 2}], "more": ["x", "y"]})"};
+
+  auto background = [&]()
+  {
+    json_reclaimer reclaimer{};
+    std::vector<json_value> trees;
+    for (int i = 0; i < 10; ++i)
+      trees.push_back(parse(str));
+
+    // Destroying them here would free every node, only the queue may
+    // give back a buffer as it grows
+    auto before = g_deallocations;
+    for (auto &tree : trees)
+      reclaimer.dispose(std::move(tree));
+    assert(g_deallocations - before < trees.size());
+
+    reclaimer.drain();
+    assert(reclaimer.pending() == 0);
+    assert(reclaimer.collect() == 0);
+  };
+
+  auto batched = [&]()
+  {
+    json_reclaimer reclaimer{false};
+    reclaimer.dispose(parse(str));
+    reclaimer.dispose(parse(str));
+    assert(reclaimer.pending() == 2);
+
+    auto before = g_deallocations;
+    assert(reclaimer.collect() == 2);
+    assert(g_deallocations > before);
+    assert(reclaimer.pending() == 0);
+
+    // Whatever is left goes with the reclaimer
+    reclaimer.dispose(parse(str));
+  };
+
+  auto concurrent = [&]()
+  {
+    json_reclaimer reclaimer{};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+      threads.emplace_back([&]()
+                           {
+                             for (int i = 0; i < 50; ++i)
+                               reclaimer.dispose(parse(str));
+                           });
+    for (auto &thread : threads)
+      thread.join();
+    reclaimer.drain();
+    assert(reclaimer.pending() == 0);
+  };
+
+  background();
+  batched();
+  concurrent();
+}
+
+void test_round_trip()
+{
+  std::string str{"{\n  \"id\": 7,\n  \"price\": 1.50,\n  \"scale\": 1e2,\n  \"name\": \"caf\\u00e9\",\n"
+                  "  \"tags\": [ \"a\" , \"b\" ],\n  \"owner\": {\"name\": \"x\", \"since\": 2.0},\n  \"flags\": [true, false]\n}"};
+  parse_options options{};
+  options.keep_source = true;
+
+  auto unmodified = [&]()
+  {
+    auto value = parse(str, options);
+    assert(not value.as<json_object>().modified());
+    assert(value.as<json_object>().source() == str);
+    assert(serialize(value) == str);
+
+    // Reading does not mark anything
+    json_object const &object = value.as<json_object>();
+    assert(object.get_attribute("price").as<json_number>().get_value() == 1.5);
+    for (auto const &[name, member] : object)
+      (void)member;
+    assert(serialize(value) == str);
+  };
+
+  auto one_field = [&]()
+  {
+    auto value = parse(str, options);
+    value.as<json_object>()["id"] = json_value{json_number{8}};
+    auto out = serialize(value);
+    assert(out == std::string{str}.replace(str.find("7"), 1, "8"));
+
+    // The same value written back keeps its spelling
+    value.as<json_object>()["price"] = json_value{json_number{1.5}};
+    value.as<json_object>()["name"] = json_value{json_string{"caf\xc3\xa9"}};
+    assert(serialize(value) == out);
+  };
+
+  auto nested = [&]()
+  {
+    auto value = parse(str, options);
+    auto &owner = value.as<json_object>()["owner"].as<json_object>();
+    owner.set_attribute("since", json_value{json_number{3}});
+    assert(serialize(value) == std::string{str}.replace(str.find("2.0"), 3, "3"));
+  };
+
+  auto added = [&]()
+  {
+    auto value = parse(str, options);
+    auto &object = value.as<json_object>();
+    object.insert_attribute("extra", json_value{json_null{}});
+    object["tags"].as<json_array>().push_back(json_value{json_string{"c"}});
+    object["flags"].as<json_array>().push_back(json_boolean{true});
+    auto out = serialize(value);
+    assert(out.find(R"("tags": [ "a" , "b","c" ])") != std::string::npos);
+    assert(out.find(R"("flags": [true, false,true])") != std::string::npos);
+    assert(out.find(R"("flags": [true, false,true],"extra":null)") != std::string::npos);
+    assert(parse(out) == value);
+
+    std::string blank{R"({ "list": [ ], "map": { } })"};
+    auto empty = parse(blank, options);
+    empty.as<json_object>()["list"].as<json_array>().push_back(json_value{json_number{1}});
+    empty.as<json_object>()["map"].as<json_object>()["k"] = json_value{json_number{2}};
+    assert(serialize(empty) == R"({ "list": [1 ], "map": {"k":2 } })");
+  };
+
+  auto replaced = [&]()
+  {
+    // Subtrees swapped or taken from another document keep their own text
+    auto value = parse(str, options);
+    std::string text{R"({"x": [1,  2]})"};
+    auto other = parse(text, options);
+    auto &object = value.as<json_object>();
+    auto tags = object["tags"];
+    object["tags"] = object["owner"];
+    object["owner"] = tags;
+    object["flags"] = other.as<json_object>()["x"];
+    auto out = serialize(value);
+    assert(out.find(R"("tags": {"name": "x", "since": 2.0})") != std::string::npos);
+    assert(out.find(R"("owner": [ "a" , "b" ])") != std::string::npos);
+    assert(out.find(R"("flags": [1,  2])") != std::string::npos);
+    assert(parse(out) == value);
+
+    // A repeated key leaves its object and those around it without text
+    text = R"({"a": 1, "a": 2})";
+    auto duplicate = parse(text, options);
+    assert(duplicate.as<json_object>().source().empty() and serialize(duplicate) == R"({"a":2})");
+    duplicate.as<json_object>()["b"] = json_value{json_number{3}};
+    assert(serialize(duplicate) == R"({"a":2,"b":3})");
+    auto around = parse(R"([{"k": [1,  2]}, {"a": {"b": 1, "b": 2}}])", options);
+    assert(around.as<json_array>().source().empty());
+    assert(serialize(around) == R"([{"k": [1,  2]},{"a":{"b":2}}])");
+  };
+
+  auto temporary = [&]()
+  {
+    // The tree shares the text, the input may go away first
+    auto value = parse(json_string{R"({"list": [1,  2], "n": 3})"}, options);
+    json_value tags{};
+    {
+      parser reusable{options};
+      auto copy = reusable.parse(json_string{str});
+      tags = copy.as<json_object>().get_attribute("tags");
+    }
+    assert(serialize(value) == R"({"list": [1,  2], "n": 3})");
+    assert(tags.as<json_array>().source() == R"([ "a" , "b" ])");
+    assert(serialize(tags) == R"([ "a" , "b" ])");
+  };
+
+  auto off = [&]()
+  {
+    auto value = parse(str);
+    assert(value.as<json_object>().source().empty());
+    assert(serialize(value) == R"({"flags":[true,false],"id":7,"name":"café","owner":{"name":"x","since":2},"price":1.5,"scale":100,"tags":["a","b"]})");
+  };
+
+  unmodified();
+  one_field();
+  nested();
+  added();
+  replaced();
+  temporary();
+  off();
+}
+
+void test_parallel_serialize()
+{
+  json_array records{};
+  for (int i = 0; i < 1000; ++i)
+  {
+    json_object record{};
+    record["id"] = json_value{json_number{static_cast<double>(i)}};
+    record["name"] = json_value{json_string{"row \"" + std::to_string(i) + "\"\n"}};
+    record["scores"] = json_value{json_array{std::vector<double>{0.5, 1e300, -2}}};
+    records.push_back(json_value{std::move(record)});
+  }
+
+  auto identical = [&]()
+  {
+    json_object wrapper{};
+    wrapper["count"] = json_value{json_number{1000}};
+    wrapper["data"] = json_value{records};
+    wrapper["meta"] = json_value{json_object{}};
+    wrapper["meta"].as<json_object>()["é"] = json_value{json_null{}};
+    json_object wide{};
+    for (int i = 0; i < 500; ++i)
+      wide["k" + std::to_string(i)] = json_value{json_boolean{i % 2 == 0}};
+    wrapper["wide"] = json_value{std::move(wide)};
+    // Many more runs than the threads may hold at once
+    wrapper["packed"] = json_value{json_array{std::vector<double>(100000, 0.25)}};
+
+    for (auto const &value : {json_value{records}, json_value{std::move(wrapper)}, json_value{json_number{1}},
+                              parse(R"({"small": [1, "two", {"three": 3}]})")})
+    {
+      auto text = serialize(value);
+      for (std::size_t threads : {1, 2, 3, 0})
+        assert(serialize(value, threads) == text);
+    }
+  };
+
+  auto kept_source = [&]()
+  {
+    // Parsed containers are copied whole, never split
+    auto str = serialize(json_value{records});
+    std::string text{"[\n  "};
+    text += str.substr(1, str.size() - 2) + "\n]";
+    parse_options options{};
+    options.keep_source = true;
+    auto value = parse(text, options);
+    value.as<json_array>()[3].as<json_object>()["id"] = json_value{json_number{-3}};
+    assert(serialize(value, 4) == serialize(value));
+    assert(serialize(value, 4).starts_with("[\n  {"));
+  };
+
+  auto to_file = [&]()
+  {
+    auto value = json_value{records};
+    for (std::size_t threads : {1, 4})
+    {
+      auto file = std::tmpfile();
+      serialize_to_fd(fileno(file), value, threads);
+      std::rewind(file);
+      std::string text(1 << 20, '\0');
+      text.resize(std::fread(text.data(), 1, text.size(), file));
+      std::fclose(file);
+      assert(text == serialize(value));
+    }
+
+    // Workers are stopped and joined when writing fails
+    try
+    {
+      serialize_to_fd(-1, value, 4);
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == write_error);
+    }
+  };
+
+  auto failure = [&]()
+  {
+    auto value = json_value{records};
+    value.as<json_array>()[700].as<json_object>()["id"] = json_value{json_number{std::nan("")}};
+    try
+    {
+      serialize(value, 4);
+      assert(false);
+    }
+    catch (int r)
+    {
+      assert(r == write_error);
+    }
+  };
+
+  identical();
+  kept_source();
+  to_file();
+  failure();
+}
+
 int main()
 {
   test_hsjson_parser();
+  test_parse_stats();
+  test_memory_usage();
+  test_string_decoding();
+  test_parse_limits();
+  test_reusable_parser();
+  test_json_reader();
+  test_iterators();
+  test_schema_validation();
+  test_projection();
+  test_parse_in_situ();
+  test_hashing();
+  test_columns();
+  test_json_writer();
+  test_parse_compressed();
+  test_validate();
+  test_reformat();
+  test_tape();
+  test_packed_arrays();
+  test_reclaimer();
+  test_round_trip();
+  test_parallel_serialize();
 }